@@ -0,0 +1,139 @@
+/*
+ *  headers.c
+ *  neoaa
+ */
+
+/*
+ * Measures how many headers a second NeoAAStream parses. Writes a
+ * raw archive of empty files to a temporary file, then reads it
+ * back looking up TYP, PAT and DAT like list and extract do, which
+ * decodes every field of each header. Build and run with make bench.
+ */
+
+#include "stream.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NEOAA_BENCH_ENTRIES 1000000
+#define NEOAA_BENCH_RUNS 5
+
+__attribute__((visibility ("hidden"))) static uint8_t *neo_aa_bench_field(uint8_t *pos, const char *key, char subtype, uint64_t value, size_t size) {
+    memcpy(pos, key, 3);
+    pos[3] = subtype;
+    pos += 4;
+    for (size_t i = 0; i < size; i++) {
+        pos[i] = (uint8_t)(value >> (i * 8));
+    }
+    return pos + size;
+}
+
+/* TYP PAT UID GID MOD FLG MTM CTM SIZ DAT, ten fields */
+__attribute__((visibility ("hidden"))) static size_t neo_aa_bench_header(uint8_t *header, size_t entry) {
+    char path[32];
+    int pathLength = snprintf(path, sizeof(path), "dir%zu/file%zu", entry / 1000, entry);
+    uint8_t *pos = header + 6;
+    pos = neo_aa_bench_field(pos, "TYP", '1', 'F', 1);
+    pos = neo_aa_bench_field(pos, "PAT", 'P', pathLength, 2);
+    memcpy(pos, path, pathLength);
+    pos += pathLength;
+    pos = neo_aa_bench_field(pos, "UID", '2', 501, 2);
+    pos = neo_aa_bench_field(pos, "GID", '1', 20, 1);
+    pos = neo_aa_bench_field(pos, "MOD", '2', 0644, 2);
+    pos = neo_aa_bench_field(pos, "FLG", '4', 0, 4);
+    pos = neo_aa_bench_field(pos, "MTM", 'T', 1700000000, 12);
+    pos = neo_aa_bench_field(pos, "CTM", 'T', 1700000000, 12);
+    pos = neo_aa_bench_field(pos, "SIZ", '8', 0, 8);
+    pos = neo_aa_bench_field(pos, "DAT", 'B', 0, 4);
+    size_t headerSize = pos - header;
+    memcpy(header, "AA01", 4);
+    header[4] = (uint8_t)headerSize;
+    header[5] = (uint8_t)(headerSize >> 8);
+    return headerSize;
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_bench_write_archive(const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr,"Failed to create %s\n", path);
+        return -1;
+    }
+    uint8_t header[128];
+    for (size_t entry = 0; entry < NEOAA_BENCH_ENTRIES; entry++) {
+        size_t headerSize = neo_aa_bench_header(header, entry);
+        if (fwrite(header, 1, headerSize, fp) != headerSize) {
+            fprintf(stderr,"Failed to write %s\n", path);
+            fclose(fp);
+            return -1;
+        }
+    }
+    return fclose(fp) ? -1 : 0;
+}
+
+__attribute__((visibility ("hidden"))) static double neo_aa_bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the time one pass over the archive took, or -1 */
+__attribute__((visibility ("hidden"))) static double neo_aa_bench_parse(const char *path, uint64_t *checksum) {
+    NeoAAStream stream = neo_aa_stream_open(path);
+    if (!stream) {
+        return -1;
+    }
+    size_t headers = 0;
+    double start = neo_aa_bench_now();
+    int status;
+    while ((status = neo_aa_stream_next_header(stream)) == 1) {
+        int typIndex = neo_aa_stream_get_known_field_index(stream, NEOAA_STREAM_FIELD_TYP);
+        int patIndex = neo_aa_stream_get_known_field_index(stream, NEOAA_STREAM_FIELD_PAT);
+        int datIndex = neo_aa_stream_get_known_field_index(stream, NEOAA_STREAM_FIELD_DAT);
+        size_t patLength = 0;
+        neo_aa_stream_get_field_string_view(stream, patIndex, &patLength);
+        *checksum += neo_aa_stream_get_field_uint(stream, typIndex) + patLength + neo_aa_stream_get_field_blob_size(stream, datIndex);
+        headers++;
+    }
+    double elapsed = neo_aa_bench_now() - start;
+    neo_aa_stream_close(stream);
+    if (status || headers != NEOAA_BENCH_ENTRIES) {
+        fprintf(stderr,"Failed to parse the benchmark archive\n");
+        return -1;
+    }
+    return elapsed;
+}
+
+int main(void) {
+    char path[] = "/tmp/neoaa_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        fprintf(stderr,"Failed to create a temporary file\n");
+        return 1;
+    }
+    close(fd);
+    if (neo_aa_bench_write_archive(path)) {
+        unlink(path);
+        return 1;
+    }
+    double best = 0;
+    uint64_t checksum = 0;
+    for (int run = 0; run < NEOAA_BENCH_RUNS; run++) {
+        double elapsed = neo_aa_bench_parse(path, &checksum);
+        if (elapsed < 0) {
+            unlink(path);
+            return 1;
+        }
+        if (!run || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    unlink(path);
+    printf("%d headers of 10 fields, best of %d runs\n", NEOAA_BENCH_ENTRIES, NEOAA_BENCH_RUNS);
+    printf("%.2f M headers/s (%.1f ns/header)\n", NEOAA_BENCH_ENTRIES / best / 1e6, best * 1e9 / NEOAA_BENCH_ENTRIES);
+    /* Keeps the lookups from being optimized out */
+    fprintf(stderr,"checksum %llu\n", (unsigned long long)checksum);
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ *  advise.c
+ *  neoaa
+ */
+
+#include "advise.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+void neo_aa_advise_sequential(int fd, void *map, size_t mapSize) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(F_RDAHEAD)
+    fcntl(fd, F_RDAHEAD, 1);
+#endif
+    if (map && mapSize) {
+        madvise(map, mapSize, MADV_SEQUENTIAL);
+    }
+}
+
+void neo_aa_advise_willneed(int fd, uint64_t offset, uint64_t length) {
+#if defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+    struct radvisory advisory;
+    advisory.ra_offset = (off_t)offset;
+    advisory.ra_count = length > INT32_MAX ? INT32_MAX : (int)length;
+    fcntl(fd, F_RDADVISE, &advisory);
+#endif
+}
+
+void neo_aa_advise_dontneed(int fd, void *map, uint64_t offset, uint64_t length) {
+    long pageSize = sysconf(_SC_PAGESIZE);
+    /* Only pages that were read all the way through are dropped */
+    uint64_t start = offset & ~(uint64_t)(pageSize - 1);
+    if (!length) {
+#if defined(POSIX_FADV_DONTNEED)
+        posix_fadvise(fd, (off_t)start, 0, POSIX_FADV_DONTNEED);
+#endif
+        return;
+    }
+    uint64_t end = (offset + length) & ~(uint64_t)(pageSize - 1);
+    if (end <= start) {
+        return;
+    }
+    if (map) {
+        /* Pages still mapped can not leave the page cache */
+        madvise((uint8_t *)map + start, end - start, MADV_DONTNEED);
+    }
+#if defined(POSIX_FADV_DONTNEED)
+    posix_fadvise(fd, (off_t)start, (off_t)(end - start), POSIX_FADV_DONTNEED);
+#endif
+}
+
+void neo_aa_advise_drop_written(int fd) {
+#if defined(POSIX_FADV_DONTNEED)
+    /* Dirty pages are not dropped, so write them out first */
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
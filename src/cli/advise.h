@@ -0,0 +1,34 @@
+/*
+ *  advise.h
+ *  neoaa
+ */
+
+#ifndef neoaa_advise_h
+#define neoaa_advise_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Page cache hints. These only ever tell the kernel about access
+ * patterns, so failures are ignored and they do nothing where the
+ * platform has no equivalent.
+ */
+
+/* fd, and map if it is not NULL, are read from start to end */
+void neo_aa_advise_sequential(int fd, void *map, size_t mapSize);
+
+/* The range of fd is about to be read */
+void neo_aa_advise_willneed(int fd, uint64_t offset, uint64_t length);
+
+/*
+ * The range of fd, and of map if it is not NULL, which maps fd
+ * from offset 0, was read and will not be read again. A length
+ * of 0 is the rest of the file, in which case map must be NULL.
+ */
+void neo_aa_advise_dontneed(int fd, void *map, uint64_t offset, uint64_t length);
+
+/* Writes out what was written to fd and drops it from the page cache */
+void neo_aa_advise_drop_written(int fd);
+
+#endif /* neoaa_advise_h */
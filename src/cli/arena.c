@@ -0,0 +1,91 @@
+/*
+ *  arena.c
+ *  neoaa
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define NEOAA_ARENA_ALIGN 16
+
+struct neo_aa_arena_chunk {
+    struct neo_aa_arena_chunk *next;
+    size_t size;
+    size_t used;
+    _Alignas(NEOAA_ARENA_ALIGN) uint8_t data[];
+};
+
+struct neo_aa_arena_impl {
+    /* Most recent chunk first */
+    struct neo_aa_arena_chunk *chunks;
+    size_t chunkSize;
+};
+
+NeoAAArena neo_aa_arena_create(size_t chunkSize) {
+    NeoAAArena arena = calloc(1, sizeof(struct neo_aa_arena_impl));
+    if (!arena) {
+        return NULL;
+    }
+    arena->chunkSize = chunkSize;
+    return arena;
+}
+
+void neo_aa_arena_destroy(NeoAAArena arena) {
+    if (!arena) {
+        return;
+    }
+    struct neo_aa_arena_chunk *chunk = arena->chunks;
+    while (chunk) {
+        struct neo_aa_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+void *neo_aa_arena_alloc(NeoAAArena arena, size_t size) {
+    size = (size + NEOAA_ARENA_ALIGN - 1) & ~(size_t)(NEOAA_ARENA_ALIGN - 1);
+    struct neo_aa_arena_chunk *chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        /* Allocations larger than a chunk get a chunk of their own */
+        size_t chunkSize = size > arena->chunkSize ? size : arena->chunkSize;
+        chunk = malloc(sizeof(struct neo_aa_arena_chunk) + chunkSize);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        chunk->size = chunkSize;
+        chunk->used = 0;
+        arena->chunks = chunk;
+    }
+    void *allocation = chunk->data + chunk->used;
+    chunk->used += size;
+    return allocation;
+}
+
+char *neo_aa_arena_strndup(NeoAAArena arena, const char *string, size_t length) {
+    char *copy = neo_aa_arena_alloc(arena, length + 1);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+void neo_aa_arena_reset(NeoAAArena arena) {
+    struct neo_aa_arena_chunk *chunk = arena->chunks;
+    if (!chunk) {
+        return;
+    }
+    struct neo_aa_arena_chunk *next = chunk->next;
+    while (next) {
+        struct neo_aa_arena_chunk *following = next->next;
+        free(next);
+        next = following;
+    }
+    chunk->next = NULL;
+    chunk->used = 0;
+}
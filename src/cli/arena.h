@@ -0,0 +1,29 @@
+/*
+ *  arena.h
+ *  neoaa
+ */
+
+#ifndef neoaa_arena_h
+#define neoaa_arena_h
+
+#include <stddef.h>
+
+typedef struct neo_aa_arena_impl *NeoAAArena;
+
+/*
+ * NeoAAArena is a bump allocator for small per entry metadata
+ * such as paths. Allocations are never freed one by one, all of
+ * them are released at once by reset or destroy.
+ */
+NeoAAArena neo_aa_arena_create(size_t chunkSize);
+void neo_aa_arena_destroy(NeoAAArena arena);
+
+void *neo_aa_arena_alloc(NeoAAArena arena, size_t size);
+
+/* Copies length bytes of string and NUL terminates the copy */
+char *neo_aa_arena_strndup(NeoAAArena arena, const char *string, size_t length);
+
+/* Releases every allocation, keeping the most recent chunk for reuse */
+void neo_aa_arena_reset(NeoAAArena arena);
+
+#endif /* neoaa_arena_h */
@@ -0,0 +1,57 @@
+/*
+ *  buffer.c
+ *  neoaa
+ */
+
+#include "buffer.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define NEOAA_BUFFER_HUGE_PAGE_SIZE 0x200000
+
+#if defined(MADV_HUGEPAGE)
+__attribute__((visibility ("hidden"))) static size_t neo_aa_buffer_huge_size(size_t size) {
+    return (size + NEOAA_BUFFER_HUGE_PAGE_SIZE - 1) & ~(size_t)(NEOAA_BUFFER_HUGE_PAGE_SIZE - 1);
+}
+#endif
+
+void *neo_aa_buffer_alloc(size_t size) {
+#if defined(MADV_HUGEPAGE)
+    if (size >= NEOAA_BUFFER_HUGE_PAGE_SIZE) {
+        size_t hugeSize = neo_aa_buffer_huge_size(size);
+        /* Map an extra huge page so the buffer can start on a huge page boundary */
+        uint8_t *map = mmap(NULL, hugeSize + NEOAA_BUFFER_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map != MAP_FAILED) {
+            uint8_t *buffer = (uint8_t *)(((uintptr_t)map + NEOAA_BUFFER_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(NEOAA_BUFFER_HUGE_PAGE_SIZE - 1));
+            if (buffer != map) {
+                munmap(map, buffer - map);
+            }
+            munmap(buffer + hugeSize, (map + hugeSize + NEOAA_BUFFER_HUGE_PAGE_SIZE) - (buffer + hugeSize));
+            /* Fails if transparent huge pages are disabled, the buffer still works */
+            madvise(buffer, hugeSize, MADV_HUGEPAGE);
+            return buffer;
+        }
+        /*
+         * Never fall back to malloc() here, neo_aa_buffer_free() unmaps
+         * every buffer of this size.
+         */
+        map = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return map == MAP_FAILED ? NULL : map;
+    }
+#endif
+    return malloc(size);
+}
+
+void neo_aa_buffer_free(void *buffer, size_t size) {
+    if (!buffer) {
+        return;
+    }
+#if defined(MADV_HUGEPAGE)
+    if (size >= NEOAA_BUFFER_HUGE_PAGE_SIZE) {
+        munmap(buffer, neo_aa_buffer_huge_size(size));
+        return;
+    }
+#endif
+    free(buffer);
+}
@@ -0,0 +1,24 @@
+/*
+ *  buffer.h
+ *  neoaa
+ */
+
+#ifndef neoaa_buffer_h
+#define neoaa_buffer_h
+
+#include <stddef.h>
+
+/*
+ * Allocates a buffer for large workspaces such as compressed
+ * blocks or whole files. Buffers of at least a huge page are
+ * mapped aligned to huge pages and ask for transparent huge pages,
+ * so walking them takes fewer TLB misses, and are NULL if they can
+ * not be mapped. Where huge pages are not available this is just
+ * malloc().
+ */
+void *neo_aa_buffer_alloc(size_t size);
+
+/* size must be the size the buffer was allocated with */
+void neo_aa_buffer_free(void *buffer, size_t size);
+
+#endif /* neoaa_buffer_h */
@@ -0,0 +1,191 @@
+/*
+ *  copy.c
+ *  neoaa
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* copy_file_range */
+#define _GNU_SOURCE
+#endif
+
+#include "copy.h"
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+/* Largest amount passed to one copy call, below what Linux copies at once */
+#define NEOAA_COPY_CHUNK_SIZE 0x40000000
+
+#if defined(__linux__)
+/*
+ * Set once a call failed in a way that will not change for the
+ * rest of the run, such as the archive and output being on
+ * different filesystems, so every file does not retry it.
+ */
+static int neo_aa_copy_file_range_unsupported;
+static int neo_aa_copy_sendfile_unsupported;
+
+/* Errors that mean the call can not copy between these files */
+__attribute__((visibility ("hidden"))) static int neo_aa_copy_is_unsupported(int error) {
+    return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == EBADF;
+}
+
+/*
+ * Of those, the ones that come from the kernel or the filesystems
+ * rather than this call, so the call is not tried again. EINVAL
+ * and EBADF depend on the files passed and only fall back for them.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_copy_is_permanent(int error) {
+    return error == ENOSYS || error == EXDEV || error == EOPNOTSUPP;
+}
+#endif
+
+int neo_aa_copy_range(int inFd, uint64_t offset, const void *data, uint64_t size, int outFd) {
+    uint64_t copied = 0;
+#if defined(__linux__)
+    if (!__atomic_load_n(&neo_aa_copy_file_range_unsupported, __ATOMIC_RELAXED)) {
+        loff_t inOffset = (loff_t)offset;
+        while (copied < size) {
+            uint64_t chunk = size - copied;
+            ssize_t bytesCopied = copy_file_range(inFd, &inOffset, outFd, NULL, chunk > NEOAA_COPY_CHUNK_SIZE ? NEOAA_COPY_CHUNK_SIZE : chunk, 0);
+            if (bytesCopied > 0) {
+                copied += bytesCopied;
+                continue;
+            }
+            if (bytesCopied == 0) {
+                /* inFd ended before the range did */
+                return -1;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!neo_aa_copy_is_unsupported(errno)) {
+                return -1;
+            }
+            /* Carry on from copied, outFd was advanced that far */
+            if (neo_aa_copy_is_permanent(errno)) {
+                __atomic_store_n(&neo_aa_copy_file_range_unsupported, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+    }
+    if (copied < size && !__atomic_load_n(&neo_aa_copy_sendfile_unsupported, __ATOMIC_RELAXED)) {
+        off_t inOffset = (off_t)(offset + copied);
+        while (copied < size) {
+            uint64_t chunk = size - copied;
+            ssize_t bytesCopied = sendfile(outFd, inFd, &inOffset, chunk > NEOAA_COPY_CHUNK_SIZE ? NEOAA_COPY_CHUNK_SIZE : chunk);
+            if (bytesCopied > 0) {
+                copied += bytesCopied;
+                continue;
+            }
+            if (bytesCopied == 0) {
+                return -1;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!neo_aa_copy_is_unsupported(errno)) {
+                return -1;
+            }
+            if (neo_aa_copy_is_permanent(errno)) {
+                __atomic_store_n(&neo_aa_copy_sendfile_unsupported, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+    }
+#else
+    (void)inFd;
+    (void)offset;
+#endif
+    const uint8_t *bytes = (const uint8_t *)data + copied;
+    size -= copied;
+    while (size) {
+        ssize_t bytesWritten = write(outFd, bytes, size);
+        if (bytesWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += bytesWritten;
+        size -= bytesWritten;
+    }
+    return 0;
+}
+
+int neo_aa_copy_range_at(int inFd, uint64_t offset, const void *data, uint64_t size, int outFd, uint64_t outOffset) {
+    uint64_t copied = 0;
+#if defined(__linux__)
+    if (!__atomic_load_n(&neo_aa_copy_file_range_unsupported, __ATOMIC_RELAXED)) {
+        loff_t inOffset = (loff_t)offset;
+        loff_t outPosition = (loff_t)outOffset;
+        while (copied < size) {
+            uint64_t chunk = size - copied;
+            ssize_t bytesCopied = copy_file_range(inFd, &inOffset, outFd, &outPosition, chunk > NEOAA_COPY_CHUNK_SIZE ? NEOAA_COPY_CHUNK_SIZE : chunk, 0);
+            if (bytesCopied > 0) {
+                copied += bytesCopied;
+                continue;
+            }
+            if (bytesCopied == 0) {
+                return -1;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!neo_aa_copy_is_unsupported(errno)) {
+                return -1;
+            }
+            if (neo_aa_copy_is_permanent(errno)) {
+                __atomic_store_n(&neo_aa_copy_file_range_unsupported, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+    }
+#else
+    (void)inFd;
+    (void)offset;
+#endif
+    return neo_aa_copy_pwrite((const uint8_t *)data + copied, size - copied, outFd, outOffset + copied);
+}
+
+int neo_aa_copy_pwrite(const void *data, uint64_t size, int outFd, uint64_t outOffset) {
+    const uint8_t *bytes = data;
+    while (size) {
+        ssize_t bytesWritten = pwrite(outFd, bytes, size > NEOAA_COPY_CHUNK_SIZE ? NEOAA_COPY_CHUNK_SIZE : size, (off_t)outOffset);
+        if (bytesWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += bytesWritten;
+        size -= bytesWritten;
+        outOffset += bytesWritten;
+    }
+    return 0;
+}
+
+void neo_aa_copy_preallocate(int fd, uint64_t size) {
+#if defined(__linux__)
+    /* Unlike posix_fallocate, never falls back to writing zeros */
+    fallocate(fd, 0, 0, (off_t)size);
+#elif defined(F_PREALLOCATE)
+    fstore_t store;
+    store.fst_flags = F_ALLOCATECONTIG;
+    store.fst_posmode = F_PEOFPOSMODE;
+    store.fst_offset = 0;
+    store.fst_length = (off_t)size;
+    store.fst_bytesalloc = 0;
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fd, F_PREALLOCATE, &store);
+    }
+#else
+    (void)fd;
+    (void)size;
+#endif
+}
@@ -0,0 +1,39 @@
+/*
+ *  copy.h
+ *  neoaa
+ */
+
+#ifndef neoaa_copy_h
+#define neoaa_copy_h
+
+#include <stdint.h>
+
+/*
+ * Copies size bytes at offset of inFd to outFd at its current
+ * offset. The copy is done in the kernel with copy_file_range,
+ * which also lets filesystems share the extents or copy on the
+ * server, or sendfile where that is not supported. data is the
+ * same range mapped in memory, written out with write() if the
+ * kernel can not copy. Returns 0 on success and -1 on error.
+ */
+int neo_aa_copy_range(int inFd, uint64_t offset, const void *data, uint64_t size, int outFd);
+
+/*
+ * Like neo_aa_copy_range(), but writes at outOffset of outFd so
+ * several threads can fill disjoint parts of one file at once.
+ * Falls back to pwrite() of data instead of sendfile.
+ */
+int neo_aa_copy_range_at(int inFd, uint64_t offset, const void *data, uint64_t size, int outFd, uint64_t outOffset);
+
+/* Writes size bytes of data at outOffset of outFd */
+int neo_aa_copy_pwrite(const void *data, uint64_t size, int outFd, uint64_t outOffset);
+
+/*
+ * Allocates the blocks of the first size bytes of fd up front, so
+ * a large file is laid out in one piece and writes to it do not
+ * have to allocate. Only a hint, nothing is done where the
+ * filesystem or platform can not preallocate.
+ */
+void neo_aa_copy_preallocate(int fd, uint64_t size);
+
+#endif /* neoaa_copy_h */
@@ -0,0 +1,317 @@
+/*
+ *  dircache.c
+ *  neoaa
+ */
+
+#include "dircache.h"
+#include "pathset.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+struct neo_aa_dir_cache_slot {
+    /* NUL terminated copy of the path relative to the root */
+    char *path;
+    size_t length;
+    uint32_t hash;
+    int fd;
+    /* Held slots are never evicted */
+    int refs;
+    /* Recently used list, -1 terminated */
+    int prev;
+    int next;
+};
+
+struct neo_aa_dir_cache_impl {
+    struct neo_aa_dir_cache_slot *slots;
+    size_t count;
+    size_t capacity;
+    /* Open addressing table of slot index + 1, 0 is empty */
+    int *table;
+    size_t tableSize;
+    int mostRecent;
+    int leastRecent;
+    /* Directories that were created or found to exist */
+    NeoAAPathSet made;
+    pthread_mutex_t lock;
+};
+
+/* FNV-1a */
+__attribute__((visibility ("hidden"))) static uint32_t neo_aa_dir_cache_hash(const char *path, size_t length) {
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)path[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+/* Length of the parent of path, 0 for entries of the root */
+__attribute__((visibility ("hidden"))) static size_t neo_aa_dir_cache_parent_length(const char *path, size_t length) {
+    while (length && path[length - 1] != '/') {
+        length--;
+    }
+    return length ? length - 1 : 0;
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_dir_cache_find(NeoAADirCache cache, const char *path, size_t length, uint32_t hash) {
+    size_t position = hash & (cache->tableSize - 1);
+    while (cache->table[position]) {
+        struct neo_aa_dir_cache_slot *slot = &cache->slots[cache->table[position] - 1];
+        if (slot->hash == hash && slot->length == length && memcmp(slot->path, path, length) == 0) {
+            return cache->table[position] - 1;
+        }
+        position = (position + 1) & (cache->tableSize - 1);
+    }
+    return -1;
+}
+
+__attribute__((visibility ("hidden"))) static void neo_aa_dir_cache_table_insert(NeoAADirCache cache, int index) {
+    size_t position = cache->slots[index].hash & (cache->tableSize - 1);
+    while (cache->table[position]) {
+        position = (position + 1) & (cache->tableSize - 1);
+    }
+    cache->table[position] = index + 1;
+}
+
+__attribute__((visibility ("hidden"))) static void neo_aa_dir_cache_table_remove(NeoAADirCache cache, int index) {
+    size_t mask = cache->tableSize - 1;
+    size_t position = cache->slots[index].hash & mask;
+    while (cache->table[position] != index + 1) {
+        position = (position + 1) & mask;
+    }
+    /* Shift later slots of the run back so lookups do not stop at the hole */
+    size_t next = (position + 1) & mask;
+    while (cache->table[next]) {
+        size_t home = cache->slots[cache->table[next] - 1].hash & mask;
+        if (((next - home) & mask) >= ((next - position) & mask)) {
+            cache->table[position] = cache->table[next];
+            position = next;
+        }
+        next = (next + 1) & mask;
+    }
+    cache->table[position] = 0;
+}
+
+__attribute__((visibility ("hidden"))) static void neo_aa_dir_cache_unlink(NeoAADirCache cache, int index) {
+    struct neo_aa_dir_cache_slot *slot = &cache->slots[index];
+    if (slot->prev != -1) {
+        cache->slots[slot->prev].next = slot->next;
+    } else {
+        cache->mostRecent = slot->next;
+    }
+    if (slot->next != -1) {
+        cache->slots[slot->next].prev = slot->prev;
+    } else {
+        cache->leastRecent = slot->prev;
+    }
+}
+
+__attribute__((visibility ("hidden"))) static void neo_aa_dir_cache_push(NeoAADirCache cache, int index) {
+    struct neo_aa_dir_cache_slot *slot = &cache->slots[index];
+    slot->prev = -1;
+    slot->next = cache->mostRecent;
+    if (cache->mostRecent != -1) {
+        cache->slots[cache->mostRecent].prev = index;
+    } else {
+        cache->leastRecent = index;
+    }
+    cache->mostRecent = index;
+}
+
+/* Returns a free slot, closing the least recently used one if the cache is full */
+__attribute__((visibility ("hidden"))) static int neo_aa_dir_cache_take_slot(NeoAADirCache cache) {
+    if (cache->count < cache->capacity) {
+        return (int)cache->count++;
+    }
+    for (int index = cache->leastRecent; index != -1; index = cache->slots[index].prev) {
+        struct neo_aa_dir_cache_slot *slot = &cache->slots[index];
+        if (slot->refs) {
+            continue;
+        }
+        neo_aa_dir_cache_table_remove(cache, index);
+        neo_aa_dir_cache_unlink(cache, index);
+        close(slot->fd);
+        free(slot->path);
+        slot->path = NULL;
+        return index;
+    }
+    return -1;
+}
+
+/* Creates the directory name in parentFd unless it is known to exist */
+__attribute__((visibility ("hidden"))) static int neo_aa_dir_cache_make_at(NeoAADirCache cache, int parentFd, const char *path, size_t length, const char *name) {
+    if (neo_aa_path_set_find(cache->made, path, length) != -1) {
+        return 0;
+    }
+    if (mkdirat(parentFd, name, 0755) && errno != EEXIST) {
+        return -1;
+    }
+    neo_aa_path_set_add(cache->made, path, length);
+    return 0;
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_dir_cache_acquire_locked(NeoAADirCache cache, const char *path, size_t length) {
+    int index = neo_aa_dir_cache_find(cache, path, length, neo_aa_dir_cache_hash(path, length));
+    if (index != -1) {
+        cache->slots[index].refs++;
+        neo_aa_dir_cache_unlink(cache, index);
+        neo_aa_dir_cache_push(cache, index);
+        return index;
+    }
+    /* Start from the deepest open parent, the root is always open */
+    size_t prefix = length;
+    do {
+        prefix = neo_aa_dir_cache_parent_length(path, prefix);
+        index = neo_aa_dir_cache_find(cache, path, prefix, neo_aa_dir_cache_hash(path, prefix));
+    } while (index == -1);
+    cache->slots[index].refs++;
+    while (prefix < length) {
+        size_t start = prefix ? prefix + 1 : 0;
+        const char *end = memchr(path + start, '/', length - start);
+        size_t componentEnd = end ? (size_t)(end - path) : length;
+        char *componentPath = malloc(componentEnd + 1);
+        if (!componentPath) {
+            cache->slots[index].refs--;
+            return -1;
+        }
+        memcpy(componentPath, path, componentEnd);
+        componentPath[componentEnd] = '\0';
+        int parentFd = cache->slots[index].fd;
+        int fd = -1;
+        if (neo_aa_dir_cache_make_at(cache, parentFd, componentPath, componentEnd, componentPath + start) == 0) {
+            fd = openat(parentFd, componentPath + start, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        int newIndex = fd != -1 ? neo_aa_dir_cache_take_slot(cache) : -1;
+        cache->slots[index].refs--;
+        if (newIndex == -1) {
+            /* Every slot is held if the directory opened */
+            if (fd != -1) {
+                close(fd);
+            }
+            free(componentPath);
+            return -1;
+        }
+        struct neo_aa_dir_cache_slot *slot = &cache->slots[newIndex];
+        slot->path = componentPath;
+        slot->length = componentEnd;
+        slot->hash = neo_aa_dir_cache_hash(componentPath, componentEnd);
+        slot->fd = fd;
+        slot->refs = 1;
+        neo_aa_dir_cache_table_insert(cache, newIndex);
+        neo_aa_dir_cache_push(cache, newIndex);
+        index = newIndex;
+        prefix = componentEnd;
+    }
+    return index;
+}
+
+NeoAADirCache neo_aa_dir_cache_create(const char *rootPath, size_t capacity) {
+    NeoAADirCache cache = calloc(1, sizeof(struct neo_aa_dir_cache_impl));
+    if (!cache) {
+        return NULL;
+    }
+    /* The root takes a slot, and a parent is held while a child is opened */
+    cache->capacity = capacity < 4 ? 4 : capacity;
+    cache->tableSize = 64;
+    while (cache->tableSize < cache->capacity * 2) {
+        cache->tableSize *= 2;
+    }
+    cache->slots = calloc(cache->capacity, sizeof(struct neo_aa_dir_cache_slot));
+    cache->table = calloc(cache->tableSize, sizeof(int));
+    cache->made = neo_aa_path_set_create();
+    int rootFd = open(rootPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (!cache->slots || !cache->table || !cache->made || rootFd == -1) {
+        if (rootFd != -1) {
+            close(rootFd);
+        }
+        neo_aa_path_set_destroy(cache->made);
+        free(cache->table);
+        free(cache->slots);
+        free(cache);
+        return NULL;
+    }
+    cache->mostRecent = -1;
+    cache->leastRecent = -1;
+    pthread_mutex_init(&cache->lock, NULL);
+    /* The root is held for as long as the cache exists */
+    struct neo_aa_dir_cache_slot *root = &cache->slots[0];
+    root->path = calloc(1, 1);
+    root->length = 0;
+    root->hash = neo_aa_dir_cache_hash("", 0);
+    root->fd = rootFd;
+    root->refs = 1;
+    cache->count = 1;
+    neo_aa_dir_cache_table_insert(cache, 0);
+    neo_aa_dir_cache_push(cache, 0);
+    return cache;
+}
+
+void neo_aa_dir_cache_destroy(NeoAADirCache cache) {
+    if (!cache) {
+        return;
+    }
+    for (size_t i = 0; i < cache->count; i++) {
+        if (cache->slots[i].path) {
+            close(cache->slots[i].fd);
+            free(cache->slots[i].path);
+        }
+    }
+    pthread_mutex_destroy(&cache->lock);
+    neo_aa_path_set_destroy(cache->made);
+    free(cache->table);
+    free(cache->slots);
+    free(cache);
+}
+
+int neo_aa_dir_cache_acquire(NeoAADirCache cache, const char *path, size_t length) {
+    pthread_mutex_lock(&cache->lock);
+    int handle = neo_aa_dir_cache_acquire_locked(cache, path, length);
+    pthread_mutex_unlock(&cache->lock);
+    return handle;
+}
+
+int neo_aa_dir_cache_get_fd(NeoAADirCache cache, int handle) {
+    /* Held slots are not changed by other threads */
+    return cache->slots[handle].fd;
+}
+
+void neo_aa_dir_cache_release(NeoAADirCache cache, int handle) {
+    pthread_mutex_lock(&cache->lock);
+    cache->slots[handle].refs--;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int neo_aa_dir_cache_acquire_parent(NeoAADirCache cache, const char *path, size_t length, const char **name) {
+    size_t parentLength = neo_aa_dir_cache_parent_length(path, length);
+    *name = parentLength ? path + parentLength + 1 : path;
+    return neo_aa_dir_cache_acquire(cache, path, parentLength);
+}
+
+int neo_aa_dir_cache_make(NeoAADirCache cache, const char *path, size_t length) {
+    if (!length) {
+        return 0;
+    }
+    pthread_mutex_lock(&cache->lock);
+    int failed = 0;
+    if (neo_aa_path_set_find(cache->made, path, length) == -1) {
+        size_t parentLength = neo_aa_dir_cache_parent_length(path, length);
+        int parent = neo_aa_dir_cache_acquire_locked(cache, path, parentLength);
+        if (parent == -1) {
+            failed = 1;
+        } else {
+            const char *name = parentLength ? path + parentLength + 1 : path;
+            failed = neo_aa_dir_cache_make_at(cache, cache->slots[parent].fd, path, length, name) ? 1 : 0;
+            cache->slots[parent].refs--;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return failed ? -1 : 0;
+}
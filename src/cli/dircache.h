@@ -0,0 +1,46 @@
+/*
+ *  dircache.h
+ *  neoaa
+ */
+
+#ifndef neoaa_dircache_h
+#define neoaa_dircache_h
+
+#include <stddef.h>
+
+typedef struct neo_aa_dir_cache_impl *NeoAADirCache;
+
+/*
+ * NeoAADirCache keeps up to capacity directories under a root
+ * directory open, least recently used first out, so entries can
+ * be created with the *at() calls relative to their parent
+ * instead of the kernel walking the whole path for every entry.
+ * Directories it creates are remembered and never made again.
+ * It may be used from several threads.
+ */
+NeoAADirCache neo_aa_dir_cache_create(const char *rootPath, size_t capacity);
+void neo_aa_dir_cache_destroy(NeoAADirCache cache);
+
+/*
+ * Opens the directory at path, relative to the root, creating it
+ * and its parents if they are missing. An empty path is the root.
+ * Returns a handle for neo_aa_dir_cache_get_fd() and _release(),
+ * or -1 on error. The fd stays open until the handle is released.
+ */
+int neo_aa_dir_cache_acquire(NeoAADirCache cache, const char *path, size_t length);
+int neo_aa_dir_cache_get_fd(NeoAADirCache cache, int handle);
+void neo_aa_dir_cache_release(NeoAADirCache cache, int handle);
+
+/*
+ * Acquires the parent directory of path, setting name to its
+ * last component. path must be NUL terminated at length.
+ */
+int neo_aa_dir_cache_acquire_parent(NeoAADirCache cache, const char *path, size_t length, const char **name);
+
+/*
+ * Creates the directory at path and its parents, returns 0 if
+ * it already exists. path must be NUL terminated at length.
+ */
+int neo_aa_dir_cache_make(NeoAADirCache cache, const char *path, size_t length);
+
+#endif /* neoaa_dircache_h */
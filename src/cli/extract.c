@@ -0,0 +1,1120 @@
+/*
+ *  extract.c
+ *  neoaa
+ */
+
+#include "extract.h"
+#include "reader.h"
+#include "index.h"
+#include "arena.h"
+#include "advise.h"
+#include "buffer.h"
+#include "dircache.h"
+#include "copy.h"
+#include "sparse.h"
+#include "uring.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+int neo_aa_path_is_safe(const char *path, size_t length) {
+    if (length && path[0] == '/') {
+        return 0;
+    }
+    if (memchr(path, '\0', length)) {
+        /* The path would be cut short at the NUL */
+        return 0;
+    }
+    const char *component = path;
+    const char *pathEnd = path + length;
+    while (component < pathEnd) {
+        const char *end = memchr(component, '/', pathEnd - component);
+        size_t componentLength = end ? (size_t)(end - component) : (size_t)(pathEnd - component);
+        if (componentLength == 2 && component[0] == '.' && component[1] == '.') {
+            return 0;
+        }
+        if (!end) {
+            break;
+        }
+        component = end + 1;
+    }
+    return 1;
+}
+
+void neo_aa_make_parent_dirs(char *path) {
+    for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0755);
+        *slash = '/';
+    }
+}
+
+/*
+ * Files larger than this are preallocated, and split into chunks
+ * of this size that several writers fill at once.
+ */
+#define NEOAA_EXTRACT_CHUNK_SIZE 0x800000
+
+/* Directories kept open to create entries relative to */
+#define NEOAA_EXTRACT_DIR_CACHE_SIZE 128
+
+/* Files in flight on io_uring, each opened into its own direct descriptor */
+#define NEOAA_EXTRACT_URING_FILES 64
+/* Open, write, fdatasync, fadvise and close */
+#define NEOAA_EXTRACT_URING_FILE_OPS 5
+
+#define NEOAA_EXTRACT_URING_OP_OPEN 0
+#define NEOAA_EXTRACT_URING_OP_WRITE 1
+#define NEOAA_EXTRACT_URING_OP_CLOSE 2
+/* Only complete when they fail */
+#define NEOAA_EXTRACT_URING_OP_OTHER 3
+
+#define NEOAA_EXTRACT_JOB_FREE 0
+#define NEOAA_EXTRACT_JOB_PENDING 1
+#define NEOAA_EXTRACT_JOB_WORKING 2
+
+/* Mode, owner and modification time of an extracted entry */
+struct neo_aa_extract_meta {
+    mode_t mode;
+    int hasMode;
+    int hasOwner;
+    uid_t uid;
+    gid_t gid;
+    int hasTime;
+    struct timespec mtime;
+};
+
+/* File larger than a chunk, shared by the jobs of its chunks */
+struct neo_aa_extract_large {
+    int fd;
+    /* PAT of the file, created as its last component in parent */
+    char *path;
+    size_t nameOffset;
+    int parent;
+    struct neo_aa_extract_meta meta;
+    /* Chunks being written, plus one while the decode stage queues them */
+    int refs;
+    int failed;
+};
+
+struct neo_aa_extract_job {
+    /* Chunk of a large file at fileOffset, or NULL for a whole file */
+    struct neo_aa_extract_large *file;
+    uint64_t fileOffset;
+    /* PAT of the file, created as its last component in parent */
+    char *path;
+    size_t pathCapacity;
+    size_t nameOffset;
+    /* Handle of the parent directory, released by the writer */
+    int parent;
+    /* Points into the mapped archive or at buffer */
+    const uint8_t *data;
+    /* Archive fd and offset of data if it is mapped, -1 if buffered */
+    int archiveFd;
+    uint64_t archiveOffset;
+    uint8_t *buffer;
+    size_t bufferCapacity;
+    size_t size;
+    struct neo_aa_extract_meta meta;
+    int state;
+};
+
+/*
+ * Writer threads that create, write and apply the metadata of
+ * files the decode stage queued, in a ring of jobCount slots.
+ */
+struct neo_aa_extract_pool {
+    pthread_t *threads;
+    int threadCount;
+    struct neo_aa_extract_job *jobs;
+    uint64_t jobCount;
+    /* Counters of files submitted and taken by a writer */
+    uint64_t submitted;
+    uint64_t taken;
+    int shutdown;
+    int failed;
+    int dropCache;
+    /* Zero blocks of files are left as holes */
+    int sparse;
+    NeoAADirCache dirs;
+    pthread_mutex_t lock;
+    pthread_cond_t jobReady;
+    pthread_cond_t jobDone;
+};
+
+/* File queued on io_uring as one linked chain of operations */
+struct neo_aa_extract_uring_file {
+    /* PAT of the file, created as its last component in parent */
+    char *path;
+    size_t pathCapacity;
+    size_t nameOffset;
+    int parent;
+    /* Points into the mapped archive or at buffer */
+    const uint8_t *data;
+    uint8_t *buffer;
+    size_t bufferCapacity;
+    uint32_t size;
+    /* data has zero blocks to leave as holes */
+    int sparse;
+    struct neo_aa_extract_meta meta;
+    /* Queued until its close completes */
+    int inFlight;
+    int openResult;
+    int failed;
+};
+
+/* Writes files through io_uring on the decode stage, without writer threads */
+struct neo_aa_extract_uring {
+    NeoAAUring ring;
+    struct neo_aa_extract_uring_file files[NEOAA_EXTRACT_URING_FILES];
+    unsigned freeFiles[NEOAA_EXTRACT_URING_FILES];
+    unsigned freeCount;
+    /* Applied to the mode files are opened with */
+    mode_t umask;
+    int dropCache;
+    int sparse;
+    int failed;
+};
+
+/* Directory or symlink left for the final phase */
+struct neo_aa_extract_deferred {
+    char type;
+    char *path;
+    /* Target of symlinks */
+    char *lnk;
+    struct neo_aa_extract_meta meta;
+};
+
+struct neo_aa_extractor {
+    /* Open directories of the output path */
+    NeoAADirCache dirs;
+    int dropCache;
+    int sparse;
+    struct neo_aa_extract_pool *pool;
+    struct neo_aa_extract_uring *uring;
+    /* Paths of deferred entries live until the final phase */
+    NeoAAArena deferredArena;
+    struct neo_aa_extract_deferred *deferred;
+    size_t deferredCount;
+    size_t deferredCapacity;
+};
+
+__attribute__((visibility ("hidden"))) static void neo_aa_extract_read_meta(NeoAAReader reader, struct neo_aa_extract_meta *meta) {
+    memset(meta, 0, sizeof(struct neo_aa_extract_meta));
+    int modIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_MOD);
+    if (modIndex != -1) {
+        meta->mode = (mode_t)(neo_aa_stream_get_field_uint(reader, modIndex) & 07777);
+        meta->hasMode = 1;
+    }
+    if (geteuid() == 0) {
+        int uidIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_UID);
+        int gidIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_GID);
+        if (uidIndex != -1 && gidIndex != -1) {
+            meta->uid = (uid_t)neo_aa_stream_get_field_uint(reader, uidIndex);
+            meta->gid = (gid_t)neo_aa_stream_get_field_uint(reader, gidIndex);
+            meta->hasOwner = 1;
+        }
+    }
+    int mtmIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_MTM);
+    if (mtmIndex != -1 && neo_aa_stream_get_field_timespec(reader, mtmIndex, &meta->mtime) == 0) {
+        meta->hasTime = 1;
+    }
+}
+
+__attribute__((visibility ("hidden"))) static void neo_aa_extract_apply_meta(int fd, const struct neo_aa_extract_meta *meta) {
+    if (meta->hasMode) {
+        fchmod(fd, meta->mode);
+    }
+    if (meta->hasOwner) {
+        fchown(fd, meta->uid, meta->gid);
+    }
+    if (meta->hasTime) {
+        struct timespec times[2];
+        times[0] = meta->mtime;
+        times[1] = meta->mtime;
+        futimens(fd, times);
+    }
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_finish_file(int fd, const struct neo_aa_extract_meta *meta, int dropCache) {
+    if (dropCache) {
+        neo_aa_advise_drop_written(fd);
+    }
+    neo_aa_extract_apply_meta(fd, meta);
+    return close(fd);
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_file(NeoAAReader reader, int dirFd, const char *name, const struct neo_aa_extract_meta *meta, int dropCache, int sparse) {
+    int fd = openat(dirFd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    uint64_t size = neo_aa_reader_get_size(reader);
+    /* Preallocating would fill in the holes of sparse files */
+    if (size > NEOAA_EXTRACT_CHUNK_SIZE && !sparse) {
+        neo_aa_copy_preallocate(fd, size);
+    }
+    if (neo_aa_reader_copy_to_fd(reader, fd)) {
+        /* Do not leave a truncated file behind */
+        close(fd);
+        unlinkat(dirFd, name, 0);
+        return -1;
+    }
+    return neo_aa_extract_finish_file(fd, meta, dropCache);
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_write_file(const struct neo_aa_extract_job *job, int dirFd, int dropCache, int sparse) {
+    const char *name = job->path + job->nameOffset;
+    int fd = openat(dirFd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    int failed = 0;
+    if (sparse) {
+        failed = neo_aa_sparse_write(job->archiveFd, job->archiveOffset, job->data, job->size, fd, 0);
+    } else if (job->archiveFd != -1) {
+        failed = neo_aa_copy_range(job->archiveFd, job->archiveOffset, job->data, job->size, fd);
+    } else {
+        const uint8_t *data = job->data;
+        size_t size = job->size;
+        while (size) {
+            ssize_t bytesWritten = write(fd, data, size);
+            if (bytesWritten < 0) {
+                failed = 1;
+                break;
+            }
+            data += bytesWritten;
+            size -= bytesWritten;
+        }
+    }
+    if (failed) {
+        close(fd);
+        unlinkat(dirFd, name, 0);
+        return -1;
+    }
+    return neo_aa_extract_finish_file(fd, &job->meta, dropCache);
+}
+
+/*
+ * Drops a reference to file. The last one closes it, applying its
+ * metadata, or removes it if any of its chunks failed.
+ */
+__attribute__((visibility ("hidden"))) static void neo_aa_extract_large_release(struct neo_aa_extract_pool *pool, struct neo_aa_extract_large *file) {
+    if (__atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    int failed = __atomic_load_n(&file->failed, __ATOMIC_ACQUIRE);
+    int dirFd = neo_aa_dir_cache_get_fd(pool->dirs, file->parent);
+    if (failed) {
+        close(file->fd);
+        unlinkat(dirFd, file->path + file->nameOffset, 0);
+    } else if (neo_aa_extract_finish_file(file->fd, &file->meta, pool->dropCache)) {
+        failed = 1;
+    }
+    neo_aa_dir_cache_release(pool->dirs, file->parent);
+    if (failed) {
+        fprintf(stderr,"Failed to extract %s\n", file->path);
+        pthread_mutex_lock(&pool->lock);
+        pool->failed = 1;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(file->path);
+    free(file);
+}
+
+__attribute__((visibility ("hidden"))) static void neo_aa_extract_write_chunk(struct neo_aa_extract_pool *pool, const struct neo_aa_extract_job *job) {
+    struct neo_aa_extract_large *file = job->file;
+    int failed;
+    if (pool->sparse) {
+        failed = neo_aa_sparse_write_at(job->archiveFd, job->archiveOffset, job->data, job->size, file->fd, job->fileOffset);
+    } else if (job->archiveFd != -1) {
+        failed = neo_aa_copy_range_at(job->archiveFd, job->archiveOffset, job->data, job->size, file->fd, job->fileOffset);
+    } else {
+        failed = neo_aa_copy_pwrite(job->data, job->size, file->fd, job->fileOffset);
+    }
+    if (failed) {
+        __atomic_store_n(&file->failed, 1, __ATOMIC_RELEASE);
+    }
+    neo_aa_extract_large_release(pool, file);
+}
+
+__attribute__((visibility ("hidden"))) static void *neo_aa_extract_worker(void *arg) {
+    struct neo_aa_extract_pool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->shutdown && pool->taken == pool->submitted) {
+            pthread_cond_wait(&pool->jobReady, &pool->lock);
+        }
+        if (pool->taken == pool->submitted) {
+            /* Shut down once every queued file is written */
+            break;
+        }
+        struct neo_aa_extract_job *job = &pool->jobs[pool->taken % pool->jobCount];
+        pool->taken++;
+        job->state = NEOAA_EXTRACT_JOB_WORKING;
+        pthread_mutex_unlock(&pool->lock);
+        int failed = 0;
+        if (job->file) {
+            neo_aa_extract_write_chunk(pool, job);
+        } else {
+            failed = neo_aa_extract_write_file(job, neo_aa_dir_cache_get_fd(pool->dirs, job->parent), pool->dropCache, pool->sparse);
+            neo_aa_dir_cache_release(pool->dirs, job->parent);
+            if (failed) {
+                fprintf(stderr,"Failed to extract %s\n", job->path);
+            }
+        }
+        pthread_mutex_lock(&pool->lock);
+        if (failed) {
+            pool->failed = 1;
+        }
+        job->state = NEOAA_EXTRACT_JOB_FREE;
+        pthread_cond_broadcast(&pool->jobDone);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Returns NULL if no writer thread could be started */
+__attribute__((visibility ("hidden"))) static struct neo_aa_extract_pool *neo_aa_extract_pool_create(int threadCount, NeoAADirCache dirs, int dropCache, int sparse) {
+    struct neo_aa_extract_pool *pool = calloc(1, sizeof(struct neo_aa_extract_pool));
+    if (!pool) {
+        return NULL;
+    }
+    /* Keep twice as many files queued as there are writers */
+    pool->jobCount = threadCount * 2;
+    pool->jobs = calloc(pool->jobCount, sizeof(struct neo_aa_extract_job));
+    pool->threads = calloc(threadCount, sizeof(pthread_t));
+    if (!pool->jobs || !pool->threads) {
+        free(pool->jobs);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pool->dirs = dirs;
+    pool->dropCache = dropCache;
+    pool->sparse = sparse;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->jobReady, NULL);
+    pthread_cond_init(&pool->jobDone, NULL);
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&pool->threads[i], NULL, neo_aa_extract_worker, pool)) {
+            break;
+        }
+        pool->threadCount++;
+    }
+    if (!pool->threadCount) {
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->jobReady);
+        pthread_cond_destroy(&pool->jobDone);
+        free(pool->jobs);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/* Waits for every queued file to be written, returns -1 if any failed */
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_pool_destroy(struct neo_aa_extract_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->jobReady);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    int failed = pool->failed;
+    for (uint64_t i = 0; i < pool->jobCount; i++) {
+        free(pool->jobs[i].path);
+        neo_aa_buffer_free(pool->jobs[i].buffer, pool->jobs[i].bufferCapacity);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->jobReady);
+    pthread_cond_destroy(&pool->jobDone);
+    free(pool->threads);
+    free(pool->jobs);
+    free(pool);
+    return failed ? -1 : 0;
+}
+
+/* Waits for the next slot of the ring to be free */
+__attribute__((visibility ("hidden"))) static struct neo_aa_extract_job *neo_aa_extract_pool_take_job(struct neo_aa_extract_pool *pool) {
+    struct neo_aa_extract_job *job = &pool->jobs[pool->submitted % pool->jobCount];
+    pthread_mutex_lock(&pool->lock);
+    while (job->state != NEOAA_EXTRACT_JOB_FREE) {
+        pthread_cond_wait(&pool->jobDone, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    /* The slot is not touched by writers until it is submitted again */
+    return job;
+}
+
+__attribute__((visibility ("hidden"))) static void neo_aa_extract_pool_submit_job(struct neo_aa_extract_pool *pool, struct neo_aa_extract_job *job) {
+    pthread_mutex_lock(&pool->lock);
+    job->state = NEOAA_EXTRACT_JOB_PENDING;
+    pool->submitted++;
+    pthread_cond_signal(&pool->jobReady);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_job_reserve(struct neo_aa_extract_job *job, size_t size) {
+    if (job->bufferCapacity >= size) {
+        return 0;
+    }
+    neo_aa_buffer_free(job->buffer, job->bufferCapacity);
+    job->bufferCapacity = 0;
+    job->buffer = neo_aa_buffer_alloc(size);
+    if (!job->buffer) {
+        return -1;
+    }
+    job->bufferCapacity = size;
+    return 0;
+}
+
+/*
+ * Creates the large file at path, preallocates it and queues its
+ * chunks, reading them from the archive unless data maps them.
+ * Returns 0 once the file was created, after which the writers
+ * release parent and report errors, -1 on error.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_submit_large(struct neo_aa_extract_pool *pool, NeoAAReader reader, int datIndex, uint64_t size, const uint8_t *data, uint64_t archiveOffset, const char *path, int parent, const char *name, const struct neo_aa_extract_meta *meta) {
+    struct neo_aa_extract_large *file = calloc(1, sizeof(struct neo_aa_extract_large));
+    if (!file) {
+        return -1;
+    }
+    file->path = strdup(path);
+    file->fd = file->path ? openat(neo_aa_dir_cache_get_fd(pool->dirs, parent), name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) : -1;
+    if (file->fd == -1) {
+        free(file->path);
+        free(file);
+        return -1;
+    }
+    file->nameOffset = name - path;
+    file->parent = parent;
+    file->meta = *meta;
+    file->refs = 1;
+    if (!pool->sparse) {
+        neo_aa_copy_preallocate(file->fd, size);
+    }
+    int archiveFd = data ? neo_aa_stream_get_fd(reader) : -1;
+    for (uint64_t offset = 0; offset < size; offset += NEOAA_EXTRACT_CHUNK_SIZE) {
+        size_t chunkSize = size - offset > NEOAA_EXTRACT_CHUNK_SIZE ? NEOAA_EXTRACT_CHUNK_SIZE : (size_t)(size - offset);
+        struct neo_aa_extract_job *job = neo_aa_extract_pool_take_job(pool);
+        job->file = file;
+        job->fileOffset = offset;
+        job->size = chunkSize;
+        job->archiveFd = archiveFd;
+        job->archiveOffset = archiveOffset + offset;
+        if (data) {
+            job->data = data + offset;
+        } else {
+            if (neo_aa_extract_job_reserve(job, chunkSize) || neo_aa_stream_read_field_blob(reader, datIndex, job->buffer, chunkSize) != (ssize_t)chunkSize) {
+                /* The slot stays free, the file is removed once its queued chunks are done */
+                __atomic_store_n(&file->failed, 1, __ATOMIC_RELEASE);
+                break;
+            }
+            job->data = job->buffer;
+        }
+        __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+        neo_aa_extract_pool_submit_job(pool, job);
+    }
+    neo_aa_extract_large_release(pool, file);
+    return 0;
+}
+
+/*
+ * Hands the DAT of the current entry to the writers. Raw archives
+ * are passed as a range of the archive for the writer to copy in
+ * the kernel, other files are read into the buffer of the job.
+ * Files larger than a chunk are split over several jobs. Returns 0
+ * if it was queued, in which case the writers release parent, -1
+ * on error.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_submit_file(struct neo_aa_extract_pool *pool, NeoAAReader reader, const char *path, int parent, const char *name, const struct neo_aa_extract_meta *meta) {
+    int datIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_DAT);
+    uint64_t size = datIndex != -1 ? neo_aa_stream_get_field_blob_size(reader, datIndex) : 0;
+    const uint8_t *data = NULL;
+    uint64_t archiveOffset = 0;
+    if (size) {
+        uint64_t mappedSize;
+        data = neo_aa_stream_map_blob_range(reader, datIndex, &archiveOffset, &mappedSize);
+    }
+    if (size > NEOAA_EXTRACT_CHUNK_SIZE) {
+        return neo_aa_extract_submit_large(pool, reader, datIndex, size, data, archiveOffset, path, parent, name, meta);
+    }
+    struct neo_aa_extract_job *job = neo_aa_extract_pool_take_job(pool);
+    job->file = NULL;
+    size_t pathLength = strlen(path);
+    if (job->pathCapacity < pathLength + 1) {
+        char *newPath = realloc(job->path, pathLength + 1);
+        if (!newPath) {
+            return -1;
+        }
+        job->path = newPath;
+        job->pathCapacity = pathLength + 1;
+    }
+    memcpy(job->path, path, pathLength + 1);
+    job->nameOffset = name - path;
+    job->parent = parent;
+    job->archiveFd = data ? neo_aa_stream_get_fd(reader) : -1;
+    job->archiveOffset = archiveOffset;
+    if (size && !data) {
+        if (neo_aa_extract_job_reserve(job, size)) {
+            return -1;
+        }
+        if (neo_aa_stream_read_field_blob(reader, datIndex, job->buffer, size) != (ssize_t)size) {
+            return -1;
+        }
+        data = job->buffer;
+    }
+    job->data = data;
+    job->size = size;
+    job->meta = *meta;
+    neo_aa_extract_pool_submit_job(pool, job);
+    return 0;
+}
+
+/* Returns NULL if io_uring can not be used */
+__attribute__((visibility ("hidden"))) static struct neo_aa_extract_uring *neo_aa_extract_uring_create(int dropCache, int sparse) {
+    NeoAAUring ring = neo_aa_uring_create(NEOAA_EXTRACT_URING_FILES * NEOAA_EXTRACT_URING_FILE_OPS, NEOAA_EXTRACT_URING_FILES);
+    if (!ring) {
+        return NULL;
+    }
+    struct neo_aa_extract_uring *uring = calloc(1, sizeof(struct neo_aa_extract_uring));
+    if (!uring) {
+        neo_aa_uring_destroy(ring);
+        return NULL;
+    }
+    uring->ring = ring;
+    for (unsigned i = 0; i < NEOAA_EXTRACT_URING_FILES; i++) {
+        uring->freeFiles[i] = NEOAA_EXTRACT_URING_FILES - 1 - i;
+    }
+    uring->freeCount = NEOAA_EXTRACT_URING_FILES;
+    uring->umask = umask(0);
+    umask(uring->umask);
+    uring->dropCache = dropCache;
+    uring->sparse = sparse;
+    return uring;
+}
+
+/*
+ * Applies the metadata open could not once the chain of file is
+ * done. Files that already existed are written over without
+ * io_uring, since open only applies the mode to new files, as are
+ * files with holes, which one write would fill in.
+ */
+__attribute__((visibility ("hidden"))) static void neo_aa_extract_uring_complete(struct neo_aa_extract_uring *uring, NeoAADirCache dirs, unsigned index) {
+    struct neo_aa_extract_uring_file *file = &uring->files[index];
+    int dirFd = neo_aa_dir_cache_get_fd(dirs, file->parent);
+    const char *name = file->path + file->nameOffset;
+    int failed = file->failed;
+    if (file->openResult == -EEXIST || (file->sparse && !failed)) {
+        int fd = openat(dirFd, name, O_WRONLY | O_TRUNC | O_CLOEXEC);
+        failed = fd == -1;
+        if (fd != -1 && (uring->sparse ? neo_aa_sparse_write_at(-1, 0, file->data, file->size, fd, 0) : neo_aa_copy_pwrite(file->data, file->size, fd, 0))) {
+            close(fd);
+            unlinkat(dirFd, name, 0);
+            failed = 1;
+        } else if (fd != -1 && neo_aa_extract_finish_file(fd, &file->meta, uring->dropCache)) {
+            failed = 1;
+        }
+    } else if (failed) {
+        if (file->openResult >= 0) {
+            /* Do not leave a truncated file behind */
+            unlinkat(dirFd, name, 0);
+        }
+    } else {
+        if (file->meta.mode & uring->umask) {
+            fchmodat(dirFd, name, file->meta.mode, 0);
+        }
+        if (file->meta.hasOwner) {
+            fchownat(dirFd, name, file->meta.uid, file->meta.gid, AT_SYMLINK_NOFOLLOW);
+        }
+        if (file->meta.hasTime) {
+            struct timespec times[2];
+            times[0] = file->meta.mtime;
+            times[1] = file->meta.mtime;
+            utimensat(dirFd, name, times, AT_SYMLINK_NOFOLLOW);
+        }
+    }
+    if (failed) {
+        fprintf(stderr,"Failed to extract %s\n", file->path);
+        uring->failed = 1;
+    }
+    neo_aa_dir_cache_release(dirs, file->parent);
+    uring->freeFiles[uring->freeCount++] = index;
+}
+
+/* Submits what is queued and waits for at least waitCount completions */
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_uring_wait(struct neo_aa_extract_uring *uring, NeoAADirCache dirs, unsigned waitCount) {
+    if (neo_aa_uring_submit(uring->ring, waitCount)) {
+        return -1;
+    }
+    uint64_t userData;
+    int32_t result;
+    while (neo_aa_uring_next_completion(uring->ring, &userData, &result)) {
+        unsigned index = (unsigned)(userData >> 8);
+        struct neo_aa_extract_uring_file *file = &uring->files[index];
+        int op = (int)(userData & 0xff);
+        if (op == NEOAA_EXTRACT_URING_OP_OPEN) {
+            file->openResult = result;
+        }
+        /* Operations after a failed one complete with -ECANCELED */
+        if (result < 0 || (op == NEOAA_EXTRACT_URING_OP_WRITE && (uint32_t)result != file->size)) {
+            file->failed = 1;
+        }
+        /* Close is never skipped and is the last completion of the chain */
+        if (op == NEOAA_EXTRACT_URING_OP_CLOSE) {
+            file->inFlight = 0;
+            neo_aa_extract_uring_complete(uring, dirs, index);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Queues the DAT of the current entry as one chain that opens,
+ * writes and closes the file. Returns 0 if it was queued, in which
+ * case parent is released once the file is done, 1 if the file is
+ * too large and must be written by the caller, -1 on error.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_uring_submit_file(struct neo_aa_extract_uring *uring, NeoAADirCache dirs, NeoAAReader reader, const char *path, int parent, const char *name, const struct neo_aa_extract_meta *meta) {
+    int datIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_DAT);
+    uint64_t size = datIndex != -1 ? neo_aa_stream_get_field_blob_size(reader, datIndex) : 0;
+    if (size > NEOAA_EXTRACT_CHUNK_SIZE) {
+        return 1;
+    }
+    while (!uring->freeCount) {
+        if (neo_aa_extract_uring_wait(uring, dirs, 1)) {
+            return -1;
+        }
+    }
+    unsigned index = uring->freeFiles[uring->freeCount - 1];
+    struct neo_aa_extract_uring_file *file = &uring->files[index];
+    size_t pathLength = strlen(path);
+    if (file->pathCapacity < pathLength + 1) {
+        char *newPath = realloc(file->path, pathLength + 1);
+        if (!newPath) {
+            return -1;
+        }
+        file->path = newPath;
+        file->pathCapacity = pathLength + 1;
+    }
+    memcpy(file->path, path, pathLength + 1);
+    const uint8_t *data = NULL;
+    if (size) {
+        uint64_t archiveOffset;
+        uint64_t mappedSize;
+        data = neo_aa_stream_map_blob_range(reader, datIndex, &archiveOffset, &mappedSize);
+        if (!data) {
+            if (file->bufferCapacity < size) {
+                neo_aa_buffer_free(file->buffer, file->bufferCapacity);
+                file->bufferCapacity = 0;
+                file->buffer = neo_aa_buffer_alloc(size);
+                if (!file->buffer) {
+                    return -1;
+                }
+                file->bufferCapacity = size;
+            }
+            if (neo_aa_stream_read_field_blob(reader, datIndex, file->buffer, size) != (ssize_t)size) {
+                return -1;
+            }
+            data = file->buffer;
+        }
+    }
+    uring->freeCount--;
+    file->nameOffset = name - path;
+    file->parent = parent;
+    file->data = data;
+    file->size = (uint32_t)size;
+    file->sparse = uring->sparse && data && neo_aa_sparse_has_hole(data, size);
+    file->meta = *meta;
+    file->openResult = 0;
+    file->failed = 0;
+    file->inFlight = 1;
+    uint64_t userData = (uint64_t)index << 8;
+    /*
+     * New files get their mode from open, see neo_aa_extract_uring_complete().
+     * Direct descriptors are never inherited, O_CLOEXEC is rejected with them.
+     */
+    neo_aa_uring_queue_openat(uring->ring, neo_aa_dir_cache_get_fd(dirs, parent), file->path + file->nameOffset, O_WRONLY | O_CREAT | O_EXCL, meta->mode, index, userData | NEOAA_EXTRACT_URING_OP_OPEN, NEOAA_URING_LINK);
+    if (size && !file->sparse) {
+        neo_aa_uring_queue_write(uring->ring, index, data, file->size, 0, userData | NEOAA_EXTRACT_URING_OP_WRITE, NEOAA_URING_LINK);
+    }
+#if defined(POSIX_FADV_DONTNEED)
+    if (uring->dropCache) {
+        neo_aa_uring_queue_fdatasync(uring->ring, index, userData | NEOAA_EXTRACT_URING_OP_OTHER, NEOAA_URING_LINK | NEOAA_URING_SKIP_SUCCESS);
+        neo_aa_uring_queue_fadvise(uring->ring, index, 0, 0, POSIX_FADV_DONTNEED, userData | NEOAA_EXTRACT_URING_OP_OTHER, NEOAA_URING_LINK | NEOAA_URING_SKIP_SUCCESS);
+    }
+#endif
+    neo_aa_uring_queue_close(uring->ring, index, userData | NEOAA_EXTRACT_URING_OP_CLOSE, 0);
+    return 0;
+}
+
+/* Waits for every queued file, returns -1 if any failed */
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_uring_destroy(struct neo_aa_extract_uring *uring, NeoAADirCache dirs) {
+    while (uring->freeCount < NEOAA_EXTRACT_URING_FILES) {
+        if (neo_aa_extract_uring_wait(uring, dirs, 1)) {
+            /* Nothing more will complete, give the directories back */
+            for (unsigned i = 0; i < NEOAA_EXTRACT_URING_FILES; i++) {
+                if (uring->files[i].inFlight) {
+                    neo_aa_dir_cache_release(dirs, uring->files[i].parent);
+                }
+            }
+            uring->failed = 1;
+            break;
+        }
+    }
+    int failed = uring->failed;
+    neo_aa_uring_destroy(uring->ring);
+    for (unsigned i = 0; i < NEOAA_EXTRACT_URING_FILES; i++) {
+        free(uring->files[i].path);
+        neo_aa_buffer_free(uring->files[i].buffer, uring->files[i].bufferCapacity);
+    }
+    free(uring);
+    return failed ? -1 : 0;
+}
+
+/*
+ * Creates an extractor writing into outputPath. With ioUring,
+ * files are written through io_uring where it is available. With
+ * threadCount above 1, they are otherwise written by that many
+ * writer threads while the caller decodes the following entries.
+ * With sparse, zero blocks of files are left as holes.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_extractor_init(struct neo_aa_extractor *extractor, const char *outputPath, int threadCount, int dropCache, int ioUring, int sparse) {
+    memset(extractor, 0, sizeof(struct neo_aa_extractor));
+    extractor->dropCache = dropCache;
+    extractor->sparse = sparse;
+    mkdir(outputPath, 0755);
+    /* Every queued file holds its parent open on top of the recently used ones */
+    size_t queuedFiles = (size_t)threadCount * 2 + (ioUring ? NEOAA_EXTRACT_URING_FILES : 0);
+    extractor->dirs = neo_aa_dir_cache_create(outputPath, NEOAA_EXTRACT_DIR_CACHE_SIZE + queuedFiles);
+    if (!extractor->dirs) {
+        fprintf(stderr,"Failed to open output directory %s\n", outputPath);
+        return -1;
+    }
+    extractor->deferredArena = neo_aa_arena_create(0x10000);
+    if (!extractor->deferredArena) {
+        neo_aa_dir_cache_destroy(extractor->dirs);
+        return -1;
+    }
+    if (ioUring) {
+        extractor->uring = neo_aa_extract_uring_create(dropCache, sparse);
+        if (!extractor->uring) {
+            fprintf(stderr,"io_uring is not available, writing files without it\n");
+        }
+    }
+    if (!extractor->uring && threadCount > 1) {
+        /* Without writers files are written on the calling thread */
+        extractor->pool = neo_aa_extract_pool_create(threadCount, extractor->dirs, dropCache, sparse);
+    }
+    return 0;
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_extractor_defer(struct neo_aa_extractor *extractor, char type, const char *path, const char *lnk, size_t lnkLength, const struct neo_aa_extract_meta *meta) {
+    if (extractor->deferredCount == extractor->deferredCapacity) {
+        size_t newCapacity = extractor->deferredCapacity ? extractor->deferredCapacity * 2 : 64;
+        struct neo_aa_extract_deferred *newDeferred = realloc(extractor->deferred, newCapacity * sizeof(struct neo_aa_extract_deferred));
+        if (!newDeferred) {
+            return -1;
+        }
+        extractor->deferred = newDeferred;
+        extractor->deferredCapacity = newCapacity;
+    }
+    struct neo_aa_extract_deferred *deferred = &extractor->deferred[extractor->deferredCount];
+    deferred->type = type;
+    deferred->path = neo_aa_arena_strndup(extractor->deferredArena, path, strlen(path));
+    deferred->lnk = lnk ? neo_aa_arena_strndup(extractor->deferredArena, lnk, lnkLength) : NULL;
+    deferred->meta = *meta;
+    if (!deferred->path || (lnk && !deferred->lnk)) {
+        return -1;
+    }
+    extractor->deferredCount++;
+    return 0;
+}
+
+/*
+ * Waits for the writers, then creates symlinks in archive order
+ * and applies directory metadata deepest first. Symlinks come
+ * last so no file is ever written through one, directory modes
+ * last so a read only directory is filled before it is locked.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_extractor_finish(struct neo_aa_extractor *extractor) {
+    int failed = 0;
+    if (extractor->pool && neo_aa_extract_pool_destroy(extractor->pool)) {
+        failed = 1;
+    }
+    if (extractor->uring && neo_aa_extract_uring_destroy(extractor->uring, extractor->dirs)) {
+        failed = 1;
+    }
+    for (size_t i = 0; i < extractor->deferredCount; i++) {
+        struct neo_aa_extract_deferred *deferred = &extractor->deferred[i];
+        if (deferred->type != 'L') {
+            continue;
+        }
+        const char *name;
+        int parent = neo_aa_dir_cache_acquire_parent(extractor->dirs, deferred->path, strlen(deferred->path), &name);
+        int dirFd = parent != -1 ? neo_aa_dir_cache_get_fd(extractor->dirs, parent) : -1;
+        if (dirFd != -1) {
+            unlinkat(dirFd, name, 0);
+        }
+        if (dirFd == -1 || symlinkat(deferred->lnk, dirFd, name)) {
+            fprintf(stderr,"Failed to create symlink %s\n", deferred->path);
+            failed = 1;
+        } else {
+            if (deferred->meta.hasOwner) {
+                fchownat(dirFd, name, deferred->meta.uid, deferred->meta.gid, AT_SYMLINK_NOFOLLOW);
+            }
+            if (deferred->meta.hasTime) {
+                struct timespec times[2];
+                times[0] = deferred->meta.mtime;
+                times[1] = deferred->meta.mtime;
+                utimensat(dirFd, name, times, AT_SYMLINK_NOFOLLOW);
+            }
+        }
+        if (parent != -1) {
+            neo_aa_dir_cache_release(extractor->dirs, parent);
+        }
+    }
+    for (size_t i = extractor->deferredCount; i > 0; i--) {
+        struct neo_aa_extract_deferred *deferred = &extractor->deferred[i - 1];
+        if (deferred->type != 'D') {
+            continue;
+        }
+        int dir = neo_aa_dir_cache_acquire(extractor->dirs, deferred->path, strlen(deferred->path));
+        if (dir != -1) {
+            neo_aa_extract_apply_meta(neo_aa_dir_cache_get_fd(extractor->dirs, dir), &deferred->meta);
+            neo_aa_dir_cache_release(extractor->dirs, dir);
+        }
+    }
+    free(extractor->deferred);
+    neo_aa_arena_destroy(extractor->deferredArena);
+    neo_aa_dir_cache_destroy(extractor->dirs);
+    return failed ? -1 : 0;
+}
+
+/*
+ * Extracts the entry whose header was just read from reader.
+ * Directories are created right away, files are written or
+ * queued for a writer, and symlinks and directory metadata are
+ * left to neo_aa_extractor_finish(). Per entry allocations come
+ * from arena.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_extract_entry(struct neo_aa_extractor *extractor, NeoAAReader reader, NeoAAPathSet paths, NeoAAArena arena) {
+    char typ = neo_aa_reader_get_type(reader);
+    size_t patLength;
+    const char *pat = neo_aa_reader_get_path(reader, &patLength);
+    if (!typ || !pat) {
+        /* Entries without a path have nothing to extract */
+        return 0;
+    }
+    if (paths) {
+        int pathIndex = neo_aa_path_set_find_covering(paths, pat, patLength);
+        if (pathIndex == -1) {
+            return 0;
+        }
+        neo_aa_path_set_mark_found(paths, pathIndex);
+    }
+    if (!neo_aa_path_is_safe(pat, patLength)) {
+        fprintf(stderr,"Skipping unsafe path %.*s\n", (int)patLength, pat);
+        return 0;
+    }
+    /* NUL terminated PAT for the *at() calls and messages */
+    char *path = neo_aa_arena_strndup(arena, pat, patLength);
+    if (!path) {
+        return -1;
+    }
+    int failed = 0;
+    struct neo_aa_extract_meta meta;
+    neo_aa_extract_read_meta(reader, &meta);
+    if (typ == 'D') {
+        if (neo_aa_dir_cache_make(extractor->dirs, path, patLength)) {
+            fprintf(stderr,"Failed to create directory %s\n", path);
+            failed = 1;
+        } else if (neo_aa_extractor_defer(extractor, 'D', path, NULL, 0, &meta)) {
+            failed = 1;
+        }
+    } else if (typ == 'F') {
+        if (!meta.hasMode) {
+            meta.mode = 0644;
+            meta.hasMode = 1;
+        }
+        const char *name;
+        int parent = neo_aa_dir_cache_acquire_parent(extractor->dirs, path, patLength, &name);
+        int status = -1;
+        if (parent != -1 && extractor->uring) {
+            status = neo_aa_extract_uring_submit_file(extractor->uring, extractor->dirs, reader, path, parent, name, &meta);
+            if (status == 0) {
+                parent = -1;
+            } else if (status == 1) {
+                status = neo_aa_extract_file(reader, neo_aa_dir_cache_get_fd(extractor->dirs, parent), name, &meta, extractor->dropCache, extractor->sparse);
+            }
+        } else if (parent != -1 && extractor->pool) {
+            status = neo_aa_extract_submit_file(extractor->pool, reader, path, parent, name, &meta);
+            if (status == 0) {
+                /* The writers own parent now */
+                parent = -1;
+            }
+        } else if (parent != -1) {
+            status = neo_aa_extract_file(reader, neo_aa_dir_cache_get_fd(extractor->dirs, parent), name, &meta, extractor->dropCache, extractor->sparse);
+        }
+        if (parent != -1) {
+            neo_aa_dir_cache_release(extractor->dirs, parent);
+        }
+        if (status) {
+            fprintf(stderr,"Failed to extract %s\n", path);
+            failed = 1;
+        }
+    } else if (typ == 'L') {
+        int lnkIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_LNK);
+        size_t lnkLength;
+        const char *lnk = neo_aa_stream_get_field_string_view(reader, lnkIndex, &lnkLength);
+        if (!lnk) {
+            fprintf(stderr,"Skipping symlink %s, it has no LNK field\n", path);
+        } else if (neo_aa_extractor_defer(extractor, 'L', path, lnk, lnkLength, &meta)) {
+            failed = 1;
+        }
+    } else {
+        /* Devices, fifos, sockets, whiteouts and metadata entries */
+        fprintf(stderr,"Skipping %s, entry type %c is not supported\n", path, typ);
+    }
+    return failed ? -1 : 0;
+}
+
+int extract_neo_aa_to_path(const char *inputPath, const char *outputPath, NeoAAPathSet paths, int threadCount, int dropCache, int ioUring, int sparse) {
+    NeoAAReader reader = neo_aa_reader_open_input(inputPath);
+    if (!reader) {
+        fprintf(stderr,"Failed to open archive to extract\n");
+        return -1;
+    }
+    neo_aa_stream_set_drop_cache(reader, dropCache);
+    neo_aa_stream_set_sparse(reader, sparse);
+    NeoAAArena arena = neo_aa_arena_create(0x10000);
+    if (!arena) {
+        neo_aa_reader_close(reader);
+        return -1;
+    }
+    /* With a sidecar index only the requested entries are read */
+    NeoAAIndex index = paths ? neo_aa_index_open(inputPath) : NULL;
+    struct neo_aa_extractor extractor;
+    if (!index && neo_aa_stream_set_thread_count(reader, threadCount)) {
+        fprintf(stderr,"Failed to start decompression threads\n");
+        neo_aa_arena_destroy(arena);
+        neo_aa_reader_close(reader);
+        return -1;
+    }
+    if (neo_aa_extractor_init(&extractor, outputPath, threadCount, dropCache, ioUring, sparse)) {
+        if (index) {
+            neo_aa_index_destroy(index);
+        }
+        neo_aa_arena_destroy(arena);
+        neo_aa_reader_close(reader);
+        return -1;
+    }
+    int failed = 0;
+    if (index) {
+        for (size_t i = 0; i < neo_aa_index_get_entry_count(index); i++) {
+            if (neo_aa_path_set_find_covering(paths, neo_aa_index_get_entry_path(index, i), neo_aa_index_get_entry_path_length(index, i)) == -1) {
+                continue;
+            }
+            if (neo_aa_index_seek_entry(index, reader, i) || neo_aa_reader_next(reader) != 1) {
+                fprintf(stderr,"Failed to read archive\n");
+                failed = 1;
+                break;
+            }
+            if (neo_aa_extract_entry(&extractor, reader, paths, arena)) {
+                failed = 1;
+            }
+            neo_aa_arena_reset(arena);
+        }
+        neo_aa_index_destroy(index);
+    } else {
+        int status;
+        while ((status = neo_aa_reader_next(reader)) == 1) {
+            if (neo_aa_extract_entry(&extractor, reader, paths, arena)) {
+                failed = 1;
+            }
+            neo_aa_arena_reset(arena);
+        }
+        if (status == -1) {
+            fprintf(stderr,"Failed to read archive\n");
+            failed = 1;
+        }
+    }
+    /* Writers may still be reading the mapped archive */
+    if (neo_aa_extractor_finish(&extractor)) {
+        failed = 1;
+    }
+    neo_aa_arena_destroy(arena);
+    neo_aa_reader_close(reader);
+    if (paths) {
+        for (size_t i = 0; i < neo_aa_path_set_count(paths); i++) {
+            if (!neo_aa_path_set_is_found(paths, (int)i)) {
+                printf("Could not find %s in the project.\n", neo_aa_path_set_get_path(paths, (int)i));
+            }
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+int recover_neo_aa_to_path(const char *inputPath, const char *outputPath, int dropCache) {
+    NeoAAReader reader = neo_aa_stream_open_damaged(inputPath);
+    if (!reader) {
+        fprintf(stderr,"Failed to open archive to recover\n");
+        return -1;
+    }
+    neo_aa_stream_set_drop_cache(reader, dropCache);
+    NeoAAArena arena = neo_aa_arena_create(0x10000);
+    if (!arena) {
+        neo_aa_reader_close(reader);
+        return -1;
+    }
+    struct neo_aa_extractor extractor;
+    if (neo_aa_extractor_init(&extractor, outputPath, 1, dropCache, 0, 0)) {
+        neo_aa_arena_destroy(arena);
+        neo_aa_reader_close(reader);
+        return -1;
+    }
+    int failed = 0;
+    size_t recovered = 0;
+    size_t damaged = 0;
+    while (1) {
+        int status = neo_aa_reader_next(reader);
+        if (status == 0) {
+            break;
+        }
+        if (status == 1) {
+            if (neo_aa_extract_entry(&extractor, reader, NULL, arena) == 0) {
+                recovered++;
+            }
+            neo_aa_arena_reset(arena);
+            continue;
+        }
+        damaged++;
+        fprintf(stderr,"Damaged data after offset %llu, searching for the next entry\n", (unsigned long long)neo_aa_stream_get_header_offset(reader));
+        status = neo_aa_stream_resync(reader);
+        if (status == 0) {
+            break;
+        }
+        if (status == -1) {
+            fprintf(stderr,"Failed to read archive\n");
+            failed = 1;
+            break;
+        }
+    }
+    if (neo_aa_extractor_finish(&extractor)) {
+        failed = 1;
+    }
+    neo_aa_arena_destroy(arena);
+    neo_aa_reader_close(reader);
+    printf("Recovered %zu entries, skipped %zu damaged regions.\n", recovered, damaged);
+    return failed ? -1 : 0;
+}
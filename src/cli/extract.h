@@ -0,0 +1,42 @@
+/*
+ *  extract.h
+ *  neoaa
+ */
+
+#ifndef neoaa_extract_h
+#define neoaa_extract_h
+
+#include <stddef.h>
+#include "pathset.h"
+
+/*
+ * Extracts the archive at inputPath into outputPath one entry
+ * at a time using NeoAAReader. If paths is not NULL, only those
+ * paths and the contents of those directories are extracted.
+ * threadCount is the amount of threads used to decompress
+ * blocks of compressed archives, and to create and write files
+ * while the following entries are decoded. Symlinks and the
+ * metadata of directories are applied once every file is written.
+ * With dropCache, the archive and the extracted files are dropped
+ * from the page cache. With ioUring, files are created and written
+ * in batches through io_uring instead of writer threads, falling
+ * back to the threads where io_uring is not available. With
+ * sparse, blocks of zeros in files are left as holes instead of
+ * being written.
+ */
+int extract_neo_aa_to_path(const char *inputPath, const char *outputPath, NeoAAPathSet paths, int threadCount, int dropCache, int ioUring, int sparse);
+
+/*
+ * Extracts every entry of the possibly damaged archive at inputPath
+ * that can still be read into outputPath, skipping over damaged
+ * data to the next intact entry.
+ */
+int recover_neo_aa_to_path(const char *inputPath, const char *outputPath, int dropCache);
+
+/* Reject absolute paths and .. components so entries stay in outputPath */
+int neo_aa_path_is_safe(const char *path, size_t length);
+
+/* Creates every missing parent directory of path */
+void neo_aa_make_parent_dirs(char *path);
+
+#endif /* neoaa_extract_h */
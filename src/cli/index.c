@@ -0,0 +1,667 @@
+/*
+ *  index.c
+ *  neoaa
+ */
+
+#include "index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <libNeoAppleArchive.h>
+
+/*
+ * Sidecar layout, all integers little endian:
+ *
+ * header:  "NAAI", u32 version, u64 archive size, u64 archive mtime,
+ *          u32 compression, u32 reserved, u64 block count, u64 entry count
+ * blocks:  u64 file offset of block header, u64 plain offset of block
+ * entries: u64 header offset, u64 DAT size, u32 block, u32 offset in block,
+ *          u8 TYP, u16 PAT length, PAT, NUL
+ */
+#define NEOAA_INDEX_VERSION 1
+#define NEOAA_INDEX_HEADER_SIZE 48
+#define NEOAA_INDEX_BLOCK_SIZE 16
+#define NEOAA_INDEX_ENTRY_SIZE 27
+
+/* Every this many paths one is stored whole, so decoding starts there */
+#define NEOAA_INDEX_PATH_RESTART 16
+
+/*
+ * Embedded seek tables end with a footer of the u64 file offset
+ * and u64 plain offset the seek table entry starts at, then magic.
+ */
+#define NEOAA_INDEX_RECORD_SIZE 23
+#define NEOAA_INDEX_FOOTER_SIZE 20
+#define NEOAA_INDEX_FOOTER_MAGIC "NAST"
+
+struct neo_aa_index_block {
+    uint64_t fileOffset;
+    uint64_t plainOffset;
+};
+
+/*
+ * Entries are kept as one array per field rather than an array
+ * of structs, so scans over a single field such as the path
+ * lengths stay within contiguous memory. The DAT size and TYP of
+ * the sidecar are not loaded, nothing reads them.
+ */
+struct neo_aa_index_impl {
+    int compression;
+    uint64_t blockCount;
+    struct neo_aa_index_block *blocks;
+    uint64_t entryCount;
+    uint64_t *headerOffsets;
+    uint32_t *entryBlocks;
+    uint32_t *blockOffsets;
+    /*
+     * Paths are front coded, each only stores what follows the
+     * prefix it shares with the path before it. pathOffsets are
+     * offsets of those suffixes in paths.
+     */
+    uint32_t *pathOffsets;
+    uint16_t *pathLengths;
+    uint16_t *pathPrefixLengths;
+    uint8_t *paths;
+    /* Last path decoded by neo_aa_index_get_entry_path() */
+    char *pathBuffer;
+    uint64_t pathBufferEntry;
+};
+
+__attribute__((visibility ("hidden"))) static uint64_t neo_aa_index_le(const uint8_t *bytes, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t)bytes[i] << (i * 8);
+    }
+    return value;
+}
+
+__attribute__((visibility ("hidden"))) static void neo_aa_index_put_le(uint8_t *bytes, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+__attribute__((visibility ("hidden"))) static uint64_t neo_aa_index_be64(const uint8_t *bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+char *neo_aa_index_default_path(const char *archivePath) {
+    size_t length = strlen(archivePath);
+    char *indexPath = malloc(length + 5);
+    if (!indexPath) {
+        return NULL;
+    }
+    memcpy(indexPath, archivePath, length);
+    memcpy(indexPath + length, ".idx", 5);
+    return indexPath;
+}
+
+/*
+ * Reads the headers of every compressed block without touching
+ * their payload, giving where each block is in the file and
+ * where its data starts in the plain stream.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_index_scan_blocks(const char *archivePath, struct neo_aa_index_block **blocks, uint64_t *blockCount, uint64_t *plainSize) {
+    int fd = open(archivePath, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    uint64_t capacity = 64;
+    uint64_t count = 0;
+    struct neo_aa_index_block *list = malloc(capacity * sizeof(struct neo_aa_index_block));
+    if (!list) {
+        close(fd);
+        return -1;
+    }
+    /* Skip the pbz* magic and block size */
+    uint64_t fileOffset = 12;
+    uint64_t plainOffset = 0;
+    uint8_t blockHeader[16];
+    ssize_t bytesRead;
+    while ((bytesRead = pread(fd, blockHeader, 16, fileOffset)) == 16) {
+        if (count == capacity) {
+            capacity *= 2;
+            struct neo_aa_index_block *newList = realloc(list, capacity * sizeof(struct neo_aa_index_block));
+            if (!newList) {
+                free(list);
+                close(fd);
+                return -1;
+            }
+            list = newList;
+        }
+        list[count].fileOffset = fileOffset;
+        list[count].plainOffset = plainOffset;
+        count++;
+        plainOffset += neo_aa_index_be64(blockHeader);
+        fileOffset += 16 + neo_aa_index_be64(blockHeader + 8);
+    }
+    close(fd);
+    if (bytesRead != 0) {
+        free(list);
+        return -1;
+    }
+    *blocks = list;
+    *blockCount = count;
+    *plainSize = plainOffset;
+    return 0;
+}
+
+/* Finds the block whose plain data contains offset */
+__attribute__((visibility ("hidden"))) static uint64_t neo_aa_index_find_block(struct neo_aa_index_block *blocks, uint64_t blockCount, uint64_t offset) {
+    uint64_t low = 0;
+    uint64_t high = blockCount;
+    while (high - low > 1) {
+        uint64_t mid = low + (high - low) / 2;
+        if (blocks[mid].plainOffset <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Writes the index of archivePath to fp. plainSize is set to the
+ * size of the plain stream of the archive.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_index_write_fp(const char *archivePath, FILE *fp, int threadCount, int dropCache, uint64_t *plainSize) {
+    struct stat st;
+    if (stat(archivePath, &st)) {
+        fprintf(stderr,"Failed to stat archive\n");
+        return -1;
+    }
+    NeoAAStream stream = neo_aa_stream_open(archivePath);
+    if (!stream) {
+        fprintf(stderr,"Failed to open archive to index\n");
+        return -1;
+    }
+    neo_aa_stream_set_drop_cache(stream, dropCache);
+    int compression = neo_aa_stream_get_compression(stream);
+    struct neo_aa_index_block *blocks = NULL;
+    uint64_t blockCount = 0;
+    *plainSize = st.st_size;
+    if (compression != NEO_AA_COMPRESSION_NONE && neo_aa_index_scan_blocks(archivePath, &blocks, &blockCount, plainSize)) {
+        fprintf(stderr,"Failed to read compressed blocks\n");
+        neo_aa_stream_close(stream);
+        return -1;
+    }
+    if (neo_aa_stream_set_thread_count(stream, threadCount)) {
+        fprintf(stderr,"Failed to start decompression threads\n");
+        free(blocks);
+        neo_aa_stream_close(stream);
+        return -1;
+    }
+    /* Entry count is filled in once every header has been read */
+    uint8_t header[NEOAA_INDEX_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, "NAAI", 4);
+    neo_aa_index_put_le(header + 4, NEOAA_INDEX_VERSION, 4);
+    neo_aa_index_put_le(header + 8, st.st_size, 8);
+    neo_aa_index_put_le(header + 16, st.st_mtime, 8);
+    neo_aa_index_put_le(header + 24, compression, 4);
+    neo_aa_index_put_le(header + 32, blockCount, 8);
+    fwrite(header, sizeof(header), 1, fp);
+    for (uint64_t i = 0; i < blockCount; i++) {
+        uint8_t block[NEOAA_INDEX_BLOCK_SIZE];
+        neo_aa_index_put_le(block, blocks[i].fileOffset, 8);
+        neo_aa_index_put_le(block + 8, blocks[i].plainOffset, 8);
+        fwrite(block, sizeof(block), 1, fp);
+    }
+    uint64_t entryCount = 0;
+    int status;
+    while ((status = neo_aa_stream_next_header(stream)) == 1) {
+        int patIndex = neo_aa_stream_get_known_field_index(stream, NEOAA_STREAM_FIELD_PAT);
+        if (patIndex == -1) {
+            continue;
+        }
+        size_t patLength;
+        const char *pat = neo_aa_stream_get_field_string_view(stream, patIndex, &patLength);
+        if (!pat) {
+            status = -1;
+            break;
+        }
+        int typIndex = neo_aa_stream_get_known_field_index(stream, NEOAA_STREAM_FIELD_TYP);
+        int datIndex = neo_aa_stream_get_known_field_index(stream, NEOAA_STREAM_FIELD_DAT);
+        uint64_t headerOffset = neo_aa_stream_get_header_offset(stream);
+        uint64_t block = 0;
+        uint64_t blockOffset = 0;
+        if (blockCount) {
+            block = neo_aa_index_find_block(blocks, blockCount, headerOffset);
+            blockOffset = headerOffset - blocks[block].plainOffset;
+        }
+        uint8_t entry[NEOAA_INDEX_ENTRY_SIZE];
+        neo_aa_index_put_le(entry, headerOffset, 8);
+        neo_aa_index_put_le(entry + 8, neo_aa_stream_get_field_blob_size(stream, datIndex), 8);
+        neo_aa_index_put_le(entry + 16, block, 4);
+        neo_aa_index_put_le(entry + 20, blockOffset, 4);
+        entry[24] = typIndex != -1 ? (uint8_t)neo_aa_stream_get_field_uint(stream, typIndex) : 0;
+        neo_aa_index_put_le(entry + 25, patLength, 2);
+        fwrite(entry, sizeof(entry), 1, fp);
+        fwrite(pat, patLength, 1, fp);
+        fputc('\0', fp);
+        entryCount++;
+    }
+    free(blocks);
+    neo_aa_stream_close(stream);
+    neo_aa_index_put_le(header + 40, entryCount, 8);
+    fseek(fp, 0, SEEK_SET);
+    fwrite(header, sizeof(header), 1, fp);
+    if (ferror(fp) || status == -1) {
+        fprintf(stderr,"Failed to write index\n");
+        return -1;
+    }
+    return 0;
+}
+
+int neo_aa_index_write(const char *archivePath, const char *indexPath, int threadCount, int dropCache) {
+    FILE *fp = fopen(indexPath, "wb");
+    if (!fp) {
+        fprintf(stderr,"Failed to open index output path\n");
+        return -1;
+    }
+    uint64_t plainSize;
+    int result = neo_aa_index_write_fp(archivePath, fp, threadCount, dropCache, &plainSize);
+    if (fclose(fp) || result) {
+        unlink(indexPath);
+        return -1;
+    }
+    return 0;
+}
+
+struct neo_aa_index_embed_state {
+    int fd;
+    uint64_t blockSize;
+    uint64_t blockLeft;
+    uint64_t remaining;
+};
+
+/*
+ * Appends data to the archive. For compressed archives (blockSize
+ * is set) the data is split into stored blocks of at most blockSize.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_index_embed_write(struct neo_aa_index_embed_state *state, const uint8_t *data, size_t size) {
+    while (size) {
+        if (state->blockSize && !state->blockLeft) {
+            state->blockLeft = state->remaining < state->blockSize ? state->remaining : state->blockSize;
+            /* Stored block, compressed size equals uncompressed size */
+            uint8_t blockHeader[16];
+            for (int i = 0; i < 8; i++) {
+                blockHeader[i] = (uint8_t)(state->blockLeft >> (56 - i * 8));
+            }
+            memcpy(blockHeader + 8, blockHeader, 8);
+            if (write(state->fd, blockHeader, 16) != 16) {
+                return -1;
+            }
+        }
+        size_t chunkSize = size;
+        if (state->blockSize && chunkSize > state->blockLeft) {
+            chunkSize = state->blockLeft;
+        }
+        ssize_t bytesWritten = write(state->fd, data, chunkSize);
+        if (bytesWritten <= 0) {
+            return -1;
+        }
+        data += bytesWritten;
+        size -= bytesWritten;
+        state->remaining -= bytesWritten;
+        if (state->blockSize) {
+            state->blockLeft -= bytesWritten;
+        }
+    }
+    return 0;
+}
+
+int neo_aa_index_embed(const char *archivePath, int threadCount, int dropCache) {
+    FILE *indexFp = tmpfile();
+    if (!indexFp) {
+        fprintf(stderr,"Failed to create temporary file for seek table\n");
+        return -1;
+    }
+    uint64_t plainSize;
+    if (neo_aa_index_write_fp(archivePath, indexFp, threadCount, dropCache, &plainSize)) {
+        fclose(indexFp);
+        return -1;
+    }
+    fseek(indexFp, 0, SEEK_END);
+    uint64_t indexSize = ftell(indexFp);
+    fseek(indexFp, 0, SEEK_SET);
+    int fd = open(archivePath, O_RDWR);
+    if (fd == -1) {
+        fclose(indexFp);
+        fprintf(stderr,"Failed to open archive to embed seek table\n");
+        return -1;
+    }
+    struct stat st;
+    uint8_t magic[12];
+    if (fstat(fd, &st) || pread(fd, magic, 12, 0) < 4) {
+        close(fd);
+        fclose(indexFp);
+        return -1;
+    }
+    int compressed = (memcmp(magic, "pbz", 3) == 0);
+    uint64_t blockSize = compressed ? neo_aa_index_be64(magic + 4) : 0;
+    /*
+     * The seek table is a metadata (TYP M) entry with no PAT, with
+     * the index and a footer as its DAT. The footer ends the file,
+     * compressed archives store the entry in uncompressed blocks.
+     */
+    uint8_t record[NEOAA_INDEX_RECORD_SIZE];
+    memcpy(record, "AA01", 4);
+    neo_aa_index_put_le(record + 4, NEOAA_INDEX_RECORD_SIZE, 2);
+    memcpy(record + 6, "TYP1M", 5);
+    memcpy(record + 11, "DATC", 4);
+    neo_aa_index_put_le(record + 15, indexSize + NEOAA_INDEX_FOOTER_SIZE, 8);
+    uint8_t footer[NEOAA_INDEX_FOOTER_SIZE];
+    neo_aa_index_put_le(footer, st.st_size, 8);
+    neo_aa_index_put_le(footer + 8, plainSize, 8);
+    memcpy(footer + 16, NEOAA_INDEX_FOOTER_MAGIC, 4);
+    struct neo_aa_index_embed_state state;
+    state.fd = fd;
+    state.blockSize = compressed ? blockSize : 0;
+    state.blockLeft = 0;
+    state.remaining = NEOAA_INDEX_RECORD_SIZE + indexSize + NEOAA_INDEX_FOOTER_SIZE;
+    uint8_t *chunk = malloc(0x10000);
+    int failed = !chunk || lseek(fd, 0, SEEK_END) == -1 || neo_aa_index_embed_write(&state, record, NEOAA_INDEX_RECORD_SIZE);
+    while (!failed) {
+        size_t bytesRead = fread(chunk, 1, 0x10000, indexFp);
+        if (!bytesRead) {
+            failed = ferror(indexFp);
+            break;
+        }
+        failed = neo_aa_index_embed_write(&state, chunk, bytesRead);
+    }
+    failed = failed || neo_aa_index_embed_write(&state, footer, NEOAA_INDEX_FOOTER_SIZE);
+    free(chunk);
+    fclose(indexFp);
+    if (failed) {
+        /* Leave the archive as it was */
+        ftruncate(fd, st.st_size);
+        close(fd);
+        fprintf(stderr,"Failed to embed seek table\n");
+        return -1;
+    }
+    return close(fd);
+}
+
+/*
+ * Parses an index, taking ownership of data, which is freed
+ * once its paths have been front coded. The archive size and
+ * mtime are only checked for sidecars, an embedded seek table is
+ * part of the archive it describes.
+ */
+__attribute__((visibility ("hidden"))) static NeoAAIndex neo_aa_index_parse(uint8_t *data, size_t indexSize, const struct stat *archiveStat) {
+    if (indexSize < NEOAA_INDEX_HEADER_SIZE || memcmp(data, "NAAI", 4) || neo_aa_index_le(data + 4, 4) != NEOAA_INDEX_VERSION) {
+        free(data);
+        return NULL;
+    }
+    if (archiveStat && (neo_aa_index_le(data + 8, 8) != (uint64_t)archiveStat->st_size || neo_aa_index_le(data + 16, 8) != (uint64_t)archiveStat->st_mtime)) {
+        fprintf(stderr,"Ignoring index, archive was modified after it was indexed\n");
+        free(data);
+        return NULL;
+    }
+    NeoAAIndex index = calloc(1, sizeof(struct neo_aa_index_impl));
+    if (!index) {
+        free(data);
+        return NULL;
+    }
+    index->pathBufferEntry = UINT64_MAX;
+    index->compression = (int)neo_aa_index_le(data + 24, 4);
+    index->blockCount = neo_aa_index_le(data + 32, 8);
+    index->entryCount = neo_aa_index_le(data + 40, 8);
+    size_t pos = NEOAA_INDEX_HEADER_SIZE;
+    /* Path offsets are 32 bit */
+    if (indexSize > UINT32_MAX || index->blockCount > (indexSize - pos) / NEOAA_INDEX_BLOCK_SIZE || index->entryCount > indexSize / NEOAA_INDEX_ENTRY_SIZE) {
+        free(data);
+        neo_aa_index_destroy(index);
+        return NULL;
+    }
+    index->blocks = malloc((index->blockCount ? index->blockCount : 1) * sizeof(struct neo_aa_index_block));
+    /* Every entry array is carved out of one allocation, widest first */
+    size_t entryCount = index->entryCount ? index->entryCount : 1;
+    uint8_t *columns = malloc(entryCount * (sizeof(uint64_t) + sizeof(uint32_t) * 3 + sizeof(uint16_t) * 2));
+    /* Suffixes are never longer than the paths in the sidecar */
+    index->paths = malloc(indexSize ? indexSize : 1);
+    index->pathBuffer = malloc(UINT16_MAX + 1);
+    if (!index->blocks || !columns || !index->paths || !index->pathBuffer) {
+        free(columns);
+        free(data);
+        neo_aa_index_destroy(index);
+        return NULL;
+    }
+    index->headerOffsets = (uint64_t *)columns;
+    index->entryBlocks = (uint32_t *)(index->headerOffsets + entryCount);
+    index->blockOffsets = index->entryBlocks + entryCount;
+    index->pathOffsets = index->blockOffsets + entryCount;
+    index->pathLengths = (uint16_t *)(index->pathOffsets + entryCount);
+    index->pathPrefixLengths = index->pathLengths + entryCount;
+    size_t pathsSize = 0;
+    const uint8_t *previousPath = NULL;
+    for (uint64_t i = 0; i < index->blockCount; i++) {
+        index->blocks[i].fileOffset = neo_aa_index_le(data + pos, 8);
+        index->blocks[i].plainOffset = neo_aa_index_le(data + pos + 8, 8);
+        pos += NEOAA_INDEX_BLOCK_SIZE;
+    }
+    for (uint64_t i = 0; i < index->entryCount; i++) {
+        if (indexSize - pos < NEOAA_INDEX_ENTRY_SIZE) {
+            free(data);
+            neo_aa_index_destroy(index);
+            return NULL;
+        }
+        index->headerOffsets[i] = neo_aa_index_le(data + pos, 8);
+        index->entryBlocks[i] = (uint32_t)neo_aa_index_le(data + pos + 16, 4);
+        index->blockOffsets[i] = (uint32_t)neo_aa_index_le(data + pos + 20, 4);
+        uint16_t pathLength = (uint16_t)neo_aa_index_le(data + pos + 25, 2);
+        index->pathLengths[i] = pathLength;
+        pos += NEOAA_INDEX_ENTRY_SIZE;
+        if (indexSize - pos < (size_t)pathLength + 1 || data[pos + pathLength] != '\0' || (index->blockCount && index->entryBlocks[i] >= index->blockCount)) {
+            free(data);
+            neo_aa_index_destroy(index);
+            return NULL;
+        }
+        const uint8_t *path = data + pos;
+        uint16_t prefixLength = 0;
+        if (i % NEOAA_INDEX_PATH_RESTART) {
+            uint16_t maxPrefixLength = index->pathLengths[i - 1] < pathLength ? index->pathLengths[i - 1] : pathLength;
+            while (prefixLength < maxPrefixLength && previousPath[prefixLength] == path[prefixLength]) {
+                prefixLength++;
+            }
+        }
+        index->pathPrefixLengths[i] = prefixLength;
+        index->pathOffsets[i] = (uint32_t)pathsSize;
+        memcpy(index->paths + pathsSize, path + prefixLength, pathLength - prefixLength);
+        pathsSize += pathLength - prefixLength;
+        previousPath = path;
+        pos += pathLength + 1;
+    }
+    /* The sidecar itself is not needed anymore */
+    free(data);
+    uint8_t *paths = realloc(index->paths, pathsSize ? pathsSize : 1);
+    if (paths) {
+        index->paths = paths;
+    }
+    return index;
+}
+
+/*
+ * Loads the seek table embedded at the end of archivePath. The
+ * footer gives where the seek table entry starts, the index is its
+ * DAT minus the footer.
+ */
+__attribute__((visibility ("hidden"))) static NeoAAIndex neo_aa_index_open_embedded(const char *archivePath, const struct stat *archiveStat) {
+    if (archiveStat->st_size < NEOAA_INDEX_FOOTER_SIZE) {
+        return NULL;
+    }
+    int fd = open(archivePath, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    uint8_t footer[NEOAA_INDEX_FOOTER_SIZE];
+    ssize_t bytesRead = pread(fd, footer, NEOAA_INDEX_FOOTER_SIZE, archiveStat->st_size - NEOAA_INDEX_FOOTER_SIZE);
+    close(fd);
+    if (bytesRead != NEOAA_INDEX_FOOTER_SIZE || memcmp(footer + 16, NEOAA_INDEX_FOOTER_MAGIC, 4)) {
+        /* No seek table, which is fine */
+        return NULL;
+    }
+    uint64_t fileOffset = neo_aa_index_le(footer, 8);
+    uint64_t plainOffset = neo_aa_index_le(footer + 8, 8);
+    NeoAAStream stream = neo_aa_stream_open(archivePath);
+    if (!stream) {
+        return NULL;
+    }
+    int seekFailed;
+    if (neo_aa_stream_get_compression(stream) == NEO_AA_COMPRESSION_NONE) {
+        seekFailed = neo_aa_stream_seek_header(stream, 0, 0, fileOffset);
+    } else {
+        seekFailed = neo_aa_stream_seek_header(stream, fileOffset, plainOffset, plainOffset);
+    }
+    if (seekFailed || neo_aa_stream_next_header(stream) != 1) {
+        neo_aa_stream_close(stream);
+        return NULL;
+    }
+    int typIndex = neo_aa_stream_get_known_field_index(stream, NEOAA_STREAM_FIELD_TYP);
+    int datIndex = neo_aa_stream_get_known_field_index(stream, NEOAA_STREAM_FIELD_DAT);
+    uint64_t datSize = neo_aa_stream_get_field_blob_size(stream, datIndex);
+    if (typIndex == -1 || neo_aa_stream_get_field_uint(stream, typIndex) != 'M' || datIndex == -1 || datSize < NEOAA_INDEX_FOOTER_SIZE + NEOAA_INDEX_HEADER_SIZE || datSize > (uint64_t)archiveStat->st_size) {
+        neo_aa_stream_close(stream);
+        return NULL;
+    }
+    uint8_t *data = malloc(datSize);
+    if (!data || neo_aa_stream_seek_blob(stream, datIndex)) {
+        free(data);
+        neo_aa_stream_close(stream);
+        return NULL;
+    }
+    uint64_t dataSize = 0;
+    while (dataSize < datSize) {
+        ssize_t chunkSize = neo_aa_stream_read_blob(stream, data + dataSize, datSize - dataSize);
+        if (chunkSize <= 0) {
+            break;
+        }
+        dataSize += chunkSize;
+    }
+    neo_aa_stream_close(stream);
+    if (dataSize != datSize) {
+        free(data);
+        return NULL;
+    }
+    return neo_aa_index_parse(data, datSize - NEOAA_INDEX_FOOTER_SIZE, NULL);
+}
+
+NeoAAIndex neo_aa_index_open(const char *archivePath) {
+    if (strcmp(archivePath, "-") == 0) {
+        /* Standard input has no sidecar and can not seek */
+        return NULL;
+    }
+    struct stat st;
+    if (stat(archivePath, &st)) {
+        return NULL;
+    }
+    char *indexPath = neo_aa_index_default_path(archivePath);
+    if (!indexPath) {
+        return NULL;
+    }
+    FILE *fp = fopen(indexPath, "rb");
+    free(indexPath);
+    if (!fp) {
+        /* No sidecar, fall back to a seek table in the archive */
+        return neo_aa_index_open_embedded(archivePath, &st);
+    }
+    fseek(fp, 0, SEEK_END);
+    size_t indexSize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = malloc(indexSize ? indexSize : 1);
+    if (!data) {
+        fclose(fp);
+        return NULL;
+    }
+    size_t bytesRead = fread(data, 1, indexSize, fp);
+    fclose(fp);
+    if (bytesRead != indexSize) {
+        free(data);
+        return NULL;
+    }
+    return neo_aa_index_parse(data, indexSize, &st);
+}
+
+void neo_aa_index_destroy(NeoAAIndex index) {
+    if (!index) {
+        return;
+    }
+    free(index->blocks);
+    /* Start of the allocation holding every entry array */
+    free(index->headerOffsets);
+    free(index->paths);
+    free(index->pathBuffer);
+    free(index);
+}
+
+size_t neo_aa_index_get_entry_count(NeoAAIndex index) {
+    return index->entryCount;
+}
+
+const char *neo_aa_index_get_entry_path(NeoAAIndex index, size_t entry) {
+    if (index->pathBufferEntry == entry) {
+        return index->pathBuffer;
+    }
+    /* Rebuild from the last whole path, or from the last decoded one */
+    uint64_t start = entry - entry % NEOAA_INDEX_PATH_RESTART;
+    if (index->pathBufferEntry != UINT64_MAX && index->pathBufferEntry >= start && index->pathBufferEntry < entry) {
+        start = index->pathBufferEntry + 1;
+    }
+    for (uint64_t i = start; i <= entry; i++) {
+        uint16_t prefixLength = index->pathPrefixLengths[i];
+        memcpy(index->pathBuffer + prefixLength, index->paths + index->pathOffsets[i], index->pathLengths[i] - prefixLength);
+    }
+    index->pathBuffer[index->pathLengths[entry]] = '\0';
+    index->pathBufferEntry = entry;
+    return index->pathBuffer;
+}
+
+size_t neo_aa_index_get_entry_path_length(NeoAAIndex index, size_t entry) {
+    return index->pathLengths[entry];
+}
+
+int64_t neo_aa_index_find_entry(NeoAAIndex index, const char *path, size_t length) {
+    if (length > UINT16_MAX) {
+        return -1;
+    }
+    /*
+     * Search the front coded paths without decoding them. matched
+     * is how much of path the previous entry's path starts with.
+     */
+    size_t matched = 0;
+    for (uint64_t i = 0; i < index->entryCount; i++) {
+        size_t prefixLength = index->pathPrefixLengths[i];
+        if (prefixLength > matched) {
+            /* Shares the byte that did not match with the previous path */
+            continue;
+        }
+        matched = prefixLength;
+        const uint8_t *suffix = index->paths + index->pathOffsets[i];
+        size_t pathLength = index->pathLengths[i];
+        while (matched < pathLength && matched < length && suffix[matched - prefixLength] == (uint8_t)path[matched]) {
+            matched++;
+        }
+        if (matched == length && pathLength == length) {
+            return (int64_t)i;
+        }
+    }
+    return -1;
+}
+
+int neo_aa_index_seek_entry(NeoAAIndex index, NeoAAStream stream, size_t entry) {
+    if (!index->blockCount) {
+        return neo_aa_stream_seek_header(stream, 0, 0, index->headerOffsets[entry]);
+    }
+    struct neo_aa_index_block *block = &index->blocks[index->entryBlocks[entry]];
+    return neo_aa_stream_seek_header(stream, block->fileOffset, block->plainOffset, block->plainOffset + index->blockOffsets[entry]);
+}
@@ -0,0 +1,55 @@
+/*
+ *  index.h
+ *  neoaa
+ */
+
+#ifndef neoaa_index_h
+#define neoaa_index_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include "stream.h"
+
+typedef struct neo_aa_index_impl *NeoAAIndex;
+
+/*
+ * A sidecar index maps the PAT of every entry to the compressed
+ * block its header is in, so a single entry can be read by
+ * decompressing only the blocks covering it. The sidecar of
+ * archive.aar is written to archive.aar.idx by default.
+ */
+char *neo_aa_index_default_path(const char *archivePath);
+
+/* With dropCache, the archive is dropped from the page cache as it is read */
+int neo_aa_index_write(const char *archivePath, const char *indexPath, int threadCount, int dropCache);
+
+/*
+ * Appends the index of archivePath to the archive itself as a
+ * metadata entry, so it needs no sidecar to be read quickly.
+ */
+int neo_aa_index_embed(const char *archivePath, int threadCount, int dropCache);
+
+/*
+ * Loads the sidecar of archivePath, or the seek table embedded in
+ * it if there is no sidecar. NULL if missing or stale.
+ */
+NeoAAIndex neo_aa_index_open(const char *archivePath);
+void neo_aa_index_destroy(NeoAAIndex index);
+
+size_t neo_aa_index_get_entry_count(NeoAAIndex index);
+
+/*
+ * Paths are stored front coded, the returned path is decoded into
+ * a buffer of the index and is only valid until the next call.
+ * Walking entries in order decodes each path once.
+ */
+const char *neo_aa_index_get_entry_path(NeoAAIndex index, size_t entry);
+size_t neo_aa_index_get_entry_path_length(NeoAAIndex index, size_t entry);
+
+/* Returns the entry whose PAT is path, or -1 if there is none */
+int64_t neo_aa_index_find_entry(NeoAAIndex index, const char *path, size_t length);
+
+/* Positions stream so its next header is the header of entry */
+int neo_aa_index_seek_entry(NeoAAIndex index, NeoAAStream stream, size_t entry);
+
+#endif /* neoaa_index_h */
@@ -19,12 +19,20 @@
 #pragma clang diagnostic ignored "-Wstrict-prototypes"
 #include <lzfse.h>
 #pragma clang diagnostic pop
+#include "stream.h"
+#include "extract.h"
+#include "pathset.h"
+#include "index.h"
+#include "reader.h"
+#include "advise.h"
+#include "buffer.h"
+#include "sparse.h"
 
 #if !(defined(_WIN32) || defined(WIN32))
 #include <sys/types.h>
 #endif
 
-#define OPTSTR "i:o:a:p:f:hv"
+#define OPTSTR "i:o:a:p:f:j:tdushv"
 
 struct option long_options[] = {
     {"input", required_argument, NULL, 'i'},
@@ -32,6 +40,11 @@ struct option long_options[] = {
     {"path", required_argument, NULL, 'p'},
     {"file", required_argument, NULL, 'f'},
     {"algorithm", required_argument, NULL, 'a'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"seek-table", no_argument, NULL, 't'},
+    {"drop-cache", no_argument, NULL, 'd'},
+    {"io-uring", no_argument, NULL, 'u'},
+    {"sparse", no_argument, NULL, 's'},
     {"help", no_argument, NULL, 'h'},
     {NULL, 0, NULL, 0}
 };
@@ -43,6 +56,8 @@ typedef enum {
     NEOAA_CMD_ADD,
     NEOAA_CMD_WRAP,
     NEOAA_CMD_UNWRAP,
+    NEOAA_CMD_INDEX,
+    NEOAA_CMD_RECOVER,
     NEOAA_CMD_VERSION,
 } NeoAACommand;
 
@@ -56,48 +71,99 @@ __attribute__((visibility ("hidden"))) static void show_help(void) {
     printf(" list: list the contents of an archive.\n");
     printf(" wrap: archive a singular file.\n");
     printf(" unwrap: extract a singular file from an archive.\n");
+    printf(" index: write a sidecar index for fast access to single files.\n");
+    printf(" recover: extract every intact file from a damaged archive.\n");
     printf(" version: display version of aa\n");
     printf("\n");
     printf("Options:\n\n");
-    printf(" -i: path to the input file or directory.\n");
+    printf(" -i: path to the input file or directory, - reads the archive from standard input.\n");
     printf(" -o: path to the output file or directory.\n");
     printf(" -a: algorithm for compression, lzfse (default), zlib, lzbitmap, raw (no compression).\n");
-    printf(" -p: specify path of file in archive to unwrap.\n");
+    printf(" -p: specify path of file in archive to unwrap, can be repeated or @file.\n");
+    printf(" -j: number of threads used to decompress the archive, and to write files when extracting.\n");
+    printf(" -t: embed a seek table in the written archive for fast access to single files.\n");
+    printf(" -d: drop the archive and written files from the page cache once they are done with.\n");
+    printf(" -u: write extracted files in batches through io_uring where the kernel supports it.\n");
+    printf(" -s: leave blocks of zeros in extracted files as holes instead of writing them.\n");
     /* printf(" -f: path of file to add to the .aar specified in -i.\n"); */
     printf(" -h: this ;-)\n\n");
 }
 
-__attribute__((visibility ("hidden"))) static void list_neo_aa_files(const char *inputPath) {
-    NeoAAArchiveGeneric genericArchive = neo_aa_archive_generic_from_path(inputPath);
-    if (!genericArchive) {
-        fprintf(stderr,"Not enough free memory to list files\n");
+__attribute__((visibility ("hidden"))) static void list_neo_aa_files(const char *inputPath, int threadCount, int dropCache) {
+    /*
+     * Walk the archive one header at a time rather than using
+     * neo_aa_archive_generic_from_path(), so DAT blobs are
+     * skipped instead of being loaded into memory.
+     */
+    NeoAAIndex index = neo_aa_index_open(inputPath);
+    if (index) {
+        /* Sidecar index already has every PAT */
+        for (size_t i = 0; i < neo_aa_index_get_entry_count(index); i++) {
+            printf("%s\n",neo_aa_index_get_entry_path(index, i));
+        }
+        neo_aa_index_destroy(index);
+        return;
+    }
+    NeoAAReader reader = neo_aa_reader_open_input(inputPath);
+    if (!reader) {
+        fprintf(stderr,"Failed to open archive to list files\n");
         return;
     }
-    NeoAAArchivePlain archive = genericArchive->raw;
-    for (int i = 0; i < archive->itemCount; i++) {
+    neo_aa_stream_set_drop_cache(reader, dropCache);
+    if (neo_aa_stream_set_thread_count(reader, threadCount)) {
+        fprintf(stderr,"Failed to start decompression threads\n");
+        neo_aa_reader_close(reader);
+        return;
+    }
+    int status;
+    while ((status = neo_aa_reader_next(reader)) == 1) {
         /*
-         * We loop through all items to find the PAT field key.
          * The PAT field key will be what path the item is in the
          * archive. This also includes symlinks.
          */
-        NeoAAArchiveItem item = archive->items[i];
-        NeoAAHeader header = item->header;
-        int index = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("PAT"));
-        if (index == -1) {
+        size_t patLength;
+        const char *pat = neo_aa_reader_get_path(reader, &patLength);
+        if (!pat) {
             continue;
         }
-        /* If index is not -1, then header has PAT field key */
-        char *patStr = neo_aa_header_get_field_key_string(header, index);
-        if (!patStr) {
-            printf("Could not get PAT entry in header\n");
-            continue;
+        printf("%.*s\n", (int)patLength, pat);
+    }
+    if (status == -1) {
+        fprintf(stderr,"Failed to read archive\n");
+    }
+    neo_aa_reader_close(reader);
+}
+
+/*
+ * Writes archive to outputPath, appending a seek table to it
+ * afterwards if seekTable is set. With dropCache the written
+ * archive is dropped from the page cache.
+ */
+__attribute__((visibility ("hidden"))) static void write_neo_aa_archive(NeoAAArchivePlain archive, int compress, const char *outputPath, int seekTable, int threadCount, int dropCache) {
+    neo_aa_archive_plain_compress_write_path(archive, compress, outputPath);
+    if (seekTable) {
+        neo_aa_index_embed(outputPath, threadCount, dropCache);
+    }
+    if (dropCache) {
+        int fd = open(outputPath, O_RDONLY);
+        if (fd != -1) {
+            neo_aa_advise_drop_written(fd);
+            close(fd);
         }
-        printf("%s\n",patStr);
-        free(patStr);
     }
 }
 
-__attribute__((visibility ("hidden"))) static void add_file_in_neo_aa(const char *inputPath, const char *outputPath, const char *addPath, int compress) {
+/* The seek table neo_aa_index_embed() appends is a TYP M entry with no PAT */
+__attribute__((visibility ("hidden"))) static int neo_aa_item_is_seek_table(NeoAAArchiveItem item) {
+    NeoAAHeader header = item->header;
+    int typIndex = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("TYP"));
+    if (typIndex == -1 || neo_aa_header_get_field_key_uint(header, typIndex) != 'M') {
+        return 0;
+    }
+    return neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("PAT")) == -1;
+}
+
+__attribute__((visibility ("hidden"))) static void add_file_in_neo_aa(const char *inputPath, const char *outputPath, const char *addPath, int compress, int seekTable, int threadCount, int dropCache) {
     NeoAAHeader header = neo_aa_header_create();
     if (!header) {
         fprintf(stderr,"Failed to create header\n");
@@ -130,16 +196,21 @@ __attribute__((visibility ("hidden"))) static void add_file_in_neo_aa(const char
     size_t binarySize = ftell(fp);
     fseek(fp, 0, SEEK_SET);
     /* allocate our uncompressed data */
-    uint8_t *data = malloc(binarySize);
+    uint8_t *data = neo_aa_buffer_alloc(binarySize);
     if (!data) {
         fclose(fp);
         neo_aa_archive_item_destroy_nozero(item);
         fprintf(stderr,"Not enough memory to allocate file into memory\n");
         return;
     }
-    ssize_t bytesRead = fread(data, binarySize, 1, fp);
+    /* Holes of sparse files are zero filled rather than read */
+    ssize_t bytesRead = neo_aa_sparse_read(fileno(fp), data, binarySize);
+    if (dropCache) {
+        neo_aa_advise_dontneed(fileno(fp), NULL, 0, 0);
+    }
     fclose(fp);
-    if (bytesRead < binarySize) {
+    if (bytesRead < (ssize_t)binarySize) {
+        neo_aa_buffer_free(data, binarySize);
         neo_aa_archive_item_destroy_nozero(item);
         fprintf(stderr,"Failed to read the entire file\n");
         return;
@@ -148,7 +219,7 @@ __attribute__((visibility ("hidden"))) static void add_file_in_neo_aa(const char
     /* Handle other than RAW later */
     neo_aa_header_set_field_blob(header, NEO_AA_FIELD_C("DAT"), 0, binarySize);
     neo_aa_archive_item_add_blob_data(item, (char *)data, binarySize);
-    free(data);
+    neo_aa_buffer_free(data, binarySize);
     
     /* Make NeoAAArchivePlain from inputPath */
     NeoAAArchiveGeneric plainInputArchive = neo_aa_archive_generic_from_path(inputPath);
@@ -160,20 +231,26 @@ __attribute__((visibility ("hidden"))) static void add_file_in_neo_aa(const char
     NeoAAArchivePlain rawInput = plainInputArchive->raw;
     /* VLAs are ugly but eh */
     NeoAAArchiveItem itemList[rawInput->itemCount + 1];
-    memcpy(itemList, rawInput->items, rawInput->itemCount);
-    itemList[rawInput->itemCount] = item;
+    int itemCount = 0;
+    for (int i = 0; i < rawInput->itemCount; i++) {
+        /* The old seek table would end up in the middle, a new one is embedded after writing */
+        if (!neo_aa_item_is_seek_table(rawInput->items[i])) {
+            itemList[itemCount++] = rawInput->items[i];
+        }
+    }
+    itemList[itemCount++] = item;
     free(plainInputArchive);
-    NeoAAArchivePlain archive = neo_aa_archive_plain_create_with_items_nocopy(itemList, rawInput->itemCount + 1);
+    NeoAAArchivePlain archive = neo_aa_archive_plain_create_with_items_nocopy(itemList, itemCount);
     neo_aa_archive_plain_destroy_nozero(rawInput);
     if (!archive) {
         fprintf(stderr,"Failed to create NeoAAArchivePlain\n");
         return;
     }
-    neo_aa_archive_plain_compress_write_path(archive, compress, outputPath);
+    write_neo_aa_archive(archive, compress, outputPath, seekTable, threadCount, dropCache);
     neo_aa_archive_plain_destroy_nozero(archive);
 }
 
-__attribute__((visibility ("hidden"))) static void wrap_file_in_neo_aa(const char *inputPath, const char *outputPath, int compress) {
+__attribute__((visibility ("hidden"))) static void wrap_file_in_neo_aa(const char *inputPath, const char *outputPath, int compress, int seekTable, int threadCount, int dropCache) {
     NeoAAHeader header = neo_aa_header_create();
     if (!header) {
         fprintf(stderr,"Failed to create header\n");
@@ -206,16 +283,21 @@ __attribute__((visibility ("hidden"))) static void wrap_file_in_neo_aa(const cha
     size_t binarySize = ftell(fp);
     fseek(fp, 0, SEEK_SET);
     /* allocate our uncompressed data */
-    uint8_t *data = malloc(binarySize);
+    uint8_t *data = neo_aa_buffer_alloc(binarySize);
     if (!data) {
         fclose(fp);
         neo_aa_archive_item_destroy_nozero(item);
         fprintf(stderr,"Not enough memory to allocate file into memory\n");
         return;
     }
-    ssize_t bytesRead = fread(data, 1, binarySize, fp);
+    /* Holes of sparse files are zero filled rather than read */
+    ssize_t bytesRead = neo_aa_sparse_read(fileno(fp), data, binarySize);
+    if (dropCache) {
+        neo_aa_advise_dontneed(fileno(fp), NULL, 0, 0);
+    }
     fclose(fp);
-    if (bytesRead < binarySize) {
+    if (bytesRead < (ssize_t)binarySize) {
+        neo_aa_buffer_free(data, binarySize);
         neo_aa_archive_item_destroy_nozero(item);
         fprintf(stderr,"Failed to read the entire file\n");
         return;
@@ -224,56 +306,175 @@ __attribute__((visibility ("hidden"))) static void wrap_file_in_neo_aa(const cha
     /* Handle other than RAW later */
     neo_aa_header_set_field_blob(header, NEO_AA_FIELD_C("DAT"), 0, binarySize);
     neo_aa_archive_item_add_blob_data(item, (char *)data, binarySize);
-    free(data);
+    neo_aa_buffer_free(data, binarySize);
     NeoAAArchiveItem *itemList = &item;
     NeoAAArchivePlain archive = neo_aa_archive_plain_create_with_items_nocopy(itemList, 1);
     if (!archive) {
         fprintf(stderr,"Failed to create NeoAAArchivePlain\n");
         return;
     }
-    neo_aa_archive_plain_compress_write_path(archive, compress, outputPath);
+    write_neo_aa_archive(archive, compress, outputPath, seekTable, threadCount, dropCache);
 }
 
-__attribute__((visibility ("hidden"))) static void unwrap_file_out_of_neo_aa(const char *inputPath, const char *outputPath, char *pathString) {
-    NeoAAArchiveGeneric genericArchive = neo_aa_archive_generic_from_path(inputPath);
-    if (!genericArchive) {
-        fprintf(stderr,"Not enough free memory to list files\n");
-        return;
+/*
+ * Unwraps the entry whose header was just read from stream if its
+ * PAT is one of paths. If outputIsDirectory is set, the file is
+ * unwrapped to its PAT inside outputPath, otherwise outputPath is
+ * the file. Returns 1 if the entry was one of paths, 0 if not.
+ */
+__attribute__((visibility ("hidden"))) static int unwrap_neo_aa_entry(NeoAAReader reader, const char *outputPath, NeoAAPathSet paths, int outputIsDirectory, int dropCache) {
+    /*
+     * The PAT field key will be what path the item is in the
+     * archive. This also includes symlinks.
+     */
+    size_t patLength;
+    const char *pat = neo_aa_reader_get_path(reader, &patLength);
+    if (!pat) {
+        return 0;
     }
-    NeoAAArchivePlain archive = genericArchive->raw;
-    for (int i = 0; i < archive->itemCount; i++) {
-        /*
-         * We loop through all items to find the PAT field key.
-         * The PAT field key will be what path the item is in the
-         * archive. This also includes symlinks.
-         */
-        NeoAAArchiveItem item = archive->items[i];
-        NeoAAHeader header = item->header;
-        int index = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("PAT"));
-        if (index == -1) {
-            continue;
+    int pathIndex = neo_aa_path_set_find(paths, pat, patLength);
+    if (pathIndex == -1 || !neo_aa_path_set_mark_found(paths, pathIndex)) {
+        return 0;
+    }
+    /* The path set holds a NUL terminated copy of PAT */
+    const char *patStr = neo_aa_path_set_get_path(paths, pathIndex);
+    /* Unwrap file */
+    char *filePath = (char *)outputPath;
+    if (outputIsDirectory) {
+        if (!neo_aa_path_is_safe(patStr, patLength)) {
+            fprintf(stderr,"Skipping unsafe path %s\n", patStr);
+            return 1;
         }
-        /* If index is not -1, then header has PAT field key */
-        char *patStr = neo_aa_header_get_field_key_string(header, index);
-        if (!patStr) {
-            printf("Could not get PAT entry in header\n");
-            continue;
+        size_t outputPathLength = strlen(outputPath);
+        filePath = malloc(outputPathLength + patLength + 2);
+        if (!filePath) {
+            fprintf(stderr,"Not enough free memory to unwrap %s\n", patStr);
+            return 1;
+        }
+        memcpy(filePath, outputPath, outputPathLength);
+        filePath[outputPathLength] = '/';
+        memcpy(filePath + outputPathLength + 1, patStr, patLength + 1);
+        neo_aa_make_parent_dirs(filePath);
+    }
+    int fd = open(filePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr,"Failed to open output path for %s.\n", patStr);
+    } else {
+        if (neo_aa_reader_copy_to_fd(reader, fd)) {
+            fprintf(stderr,"Failed to unwrap %s\n", patStr);
+            /* Do not leave a truncated file behind */
+            close(fd);
+            unlink(filePath);
+        } else {
+            if (dropCache) {
+                neo_aa_advise_drop_written(fd);
+            }
+            close(fd);
+        }
+    }
+    if (filePath != outputPath) {
+        free(filePath);
+    }
+    return 1;
+}
+
+__attribute__((visibility ("hidden"))) static void unwrap_file_out_of_neo_aa(const char *inputPath, const char *outputPath, NeoAAPathSet paths, int outputIsDirectory, int threadCount, int dropCache, int sparse) {
+    /*
+     * Stream the archive so we stop reading as soon as every
+     * requested file has been unwrapped, and so their DAT is
+     * written out in chunks rather than being loaded into memory.
+     */
+    NeoAAReader reader = neo_aa_reader_open_input(inputPath);
+    if (!reader) {
+        fprintf(stderr,"Failed to open archive to unwrap\n");
+        return;
+    }
+    neo_aa_stream_set_drop_cache(reader, dropCache);
+    neo_aa_stream_set_sparse(reader, sparse);
+    size_t remaining = neo_aa_path_set_count(paths);
+    NeoAAIndex index = neo_aa_index_open(inputPath);
+    if (index) {
+        /* Sidecar index, only decompress the blocks of the requested files */
+        if (remaining == 1) {
+            /* Single path, look it up directly */
+            const char *path = neo_aa_path_set_get_path(paths, 0);
+            int64_t entry = neo_aa_index_find_entry(index, path, strlen(path));
+            if (entry != -1) {
+                if (neo_aa_index_seek_entry(index, reader, entry) || neo_aa_reader_next(reader) != 1) {
+                    fprintf(stderr,"Failed to read archive\n");
+                } else {
+                    remaining -= unwrap_neo_aa_entry(reader, outputPath, paths, outputIsDirectory, dropCache);
+                }
+            }
         }
-        if (strncmp(pathString,patStr,strlen(pathString)) == 0) {
-            free(patStr);
-            /* Unwrap file */
-            FILE *fp = fopen(outputPath, "w");
-            if (!fp) {
-                fprintf(stderr,"Failed to open outputPath.\n");
-                return;
+        for (size_t i = 0; remaining && neo_aa_path_set_count(paths) > 1 && i < neo_aa_index_get_entry_count(index); i++) {
+            if (neo_aa_path_set_find(paths, neo_aa_index_get_entry_path(index, i), neo_aa_index_get_entry_path_length(index, i)) == -1) {
+                continue;
+            }
+            if (neo_aa_index_seek_entry(index, reader, i) || neo_aa_reader_next(reader) != 1) {
+                fprintf(stderr,"Failed to read archive\n");
+                break;
             }
-            fwrite(item->encodedBlobData, item->encodedBlobDataSize, 1, fp);
-            fclose(fp);
+            remaining -= unwrap_neo_aa_entry(reader, outputPath, paths, outputIsDirectory, dropCache);
+        }
+        neo_aa_index_destroy(index);
+    } else {
+        if (neo_aa_stream_set_thread_count(reader, threadCount)) {
+            fprintf(stderr,"Failed to start decompression threads\n");
+            neo_aa_reader_close(reader);
             return;
         }
-        free(patStr);
+        int status = 0;
+        while (remaining && (status = neo_aa_reader_next(reader)) == 1) {
+            remaining -= unwrap_neo_aa_entry(reader, outputPath, paths, outputIsDirectory, dropCache);
+        }
+        if (status == -1) {
+            fprintf(stderr,"Failed to read archive\n");
+        }
+    }
+    neo_aa_reader_close(reader);
+    if (!remaining) {
+        return;
+    }
+    if (!outputIsDirectory) {
+        printf("Could not find file at the specified path in the project.\n");
+        return;
+    }
+    for (size_t i = 0; i < neo_aa_path_set_count(paths); i++) {
+        if (!neo_aa_path_set_is_found(paths, (int)i)) {
+            printf("Could not find %s in the project.\n", neo_aa_path_set_get_path(paths, (int)i));
+        }
     }
-    printf("Could not find file at the specified path in the project.\n");
+}
+
+/*
+ * Builds the set of paths from every -p. -p @file adds every line
+ * of file, in which case listFileUsed is set.
+ */
+__attribute__((visibility ("hidden"))) static NeoAAPathSet path_set_from_specifiers(char **pathSpecifiers, int pathSpecifierCount, int *listFileUsed) {
+    NeoAAPathSet paths = neo_aa_path_set_create();
+    if (!paths) {
+        fprintf(stderr,"Not enough free memory for paths\n");
+        return NULL;
+    }
+    *listFileUsed = 0;
+    for (int i = 0; i < pathSpecifierCount; i++) {
+        const char *pathSpecifier = pathSpecifiers[i];
+        int result;
+        if (pathSpecifier[0] == '@') {
+            /* @listfile, one path per line */
+            *listFileUsed = 1;
+            result = neo_aa_path_set_add_list_file(paths, pathSpecifier + 1);
+        } else {
+            result = neo_aa_path_set_add(paths, pathSpecifier, strlen(pathSpecifier));
+        }
+        if (result == -1) {
+            fprintf(stderr,"Failed to add %s to the paths\n", pathSpecifier);
+            neo_aa_path_set_destroy(paths);
+            return NULL;
+        }
+    }
+    return paths;
 }
 
 int main(int argc, const char * argv[]) {
@@ -296,6 +497,10 @@ int main(int argc, const char * argv[]) {
         neoaaCommand = NEOAA_CMD_WRAP;
     } else if (strncmp(commandString, "unwrap", 6) == 0) {
         neoaaCommand = NEOAA_CMD_UNWRAP;
+    } else if (strncmp(commandString, "index", 5) == 0) {
+        neoaaCommand = NEOAA_CMD_INDEX;
+    } else if (strncmp(commandString, "recover", 7) == 0) {
+        neoaaCommand = NEOAA_CMD_RECOVER;
     } else if (strncmp(commandString, "version", 7) == 0) {
         neoaaCommand = NEOAA_CMD_VERSION;
     } else if (strncmp(commandString, "-h", 2) == 0) {
@@ -320,8 +525,14 @@ int main(int argc, const char * argv[]) {
     char *inputPath = NULL;
     char *outputPath = NULL;
     char *algorithmString = NULL;
-    char *pathSpecifierString = NULL;
+    char **pathSpecifiers = NULL;
+    int pathSpecifierCount = 0;
     char *fileAddString = NULL;
+    int threadCount = 1;
+    int seekTable = 0;
+    int dropCache = 0;
+    int ioUring = 0;
+    int sparse = 0;
     int showHelp = 0;
     
     /* Parse args */
@@ -334,48 +545,110 @@ int main(int argc, const char * argv[]) {
         } else if (opt == 'a') {
             algorithmString = optarg;
         } else if (opt == 'p') {
-            pathSpecifierString = optarg;
+            /* -p can be repeated to unwrap multiple files */
+            char **newPathSpecifiers = realloc(pathSpecifiers, (pathSpecifierCount + 1) * sizeof(char *));
+            if (!newPathSpecifiers) {
+                fprintf(stderr,"Not enough free memory to parse arguments\n");
+                free(pathSpecifiers);
+                return -1;
+            }
+            pathSpecifiers = newPathSpecifiers;
+            pathSpecifiers[pathSpecifierCount++] = optarg;
         } else if (opt == 'f') {
             fileAddString = optarg;
+        } else if (opt == 'j') {
+            threadCount = atoi(optarg);
+            if (threadCount < 1) {
+                threadCount = 1;
+            }
+        } else if (opt == 't') {
+            seekTable = 1;
+        } else if (opt == 'd') {
+            dropCache = 1;
+        } else if (opt == 'u') {
+            ioUring = 1;
+        } else if (opt == 's') {
+            sparse = 1;
         } else if (opt == 'h') {
             /* Show help */
             showHelp = 1;
         }
     }
+    if (showHelp || (NEOAA_CMD_UNWRAP != neoaaCommand && NEOAA_CMD_EXTRACT != neoaaCommand)) {
+        /* Only unwrap and extract take -p */
+        free(pathSpecifiers);
+        pathSpecifiers = NULL;
+        pathSpecifierCount = 0;
+    }
     if (showHelp) {
         if (NEOAA_CMD_ARCHIVE == neoaaCommand) {
             printf("Usage: neoaa archive --input <input> --output <output>\n\n");
             printf("Options:\n");
             printf("-i, --input <input>    path to the input directory to archive\n");
-            printf("-o, --output <output>  path to the output aar\n\n");
+            printf("-o, --output <output>  path to the output aar\n");
+            printf("-t, --seek-table       embed a seek table in the output aar\n");
+            printf("-d, --drop-cache       drop what was read and written from the page cache\n\n");
         } else if (NEOAA_CMD_EXTRACT == neoaaCommand) {
             printf("Usage: neoaa extract --input <input> --output <output>\n\n");
             printf("Options:\n");
             printf("-i, --input <input>    path to the input aar to extract\n");
-            printf("-o, --output <output>  path to the output directory for aar\n\n");
+            printf("-o, --output <output>  path to the output directory for aar\n");
+            printf("-p, --path <path>      only extract this path from the aar, can be\n");
+            printf("                       repeated, @file reads one path per line of file\n");
+            printf("-j, --jobs <jobs>      number of threads used to decompress and\n");
+            printf("                       to write files\n");
+            printf("-u, --io-uring         write files in batches through io_uring where\n");
+            printf("                       the kernel supports it\n");
+            printf("-s, --sparse           leave blocks of zeros in files as holes\n");
+            printf("-d, --drop-cache       drop what was read and written from the page cache\n\n");
         } else if (NEOAA_CMD_LIST == neoaaCommand) {
             printf("Usage: neoaa list --input <input>\n\n");
             printf("Options:\n");
-            printf("-i, --input <input>         path to the input aar to list\n\n");
+            printf("-i, --input <input>         path to the input aar to list\n");
+            printf("-j, --jobs <jobs>           number of threads used to decompress\n");
+            printf("-d, --drop-cache            drop what was read and written from the page cache\n\n");
         } else if (NEOAA_CMD_ADD == neoaaCommand) {
             printf("Usage: neoaa add --input <input> --output <output> --file <file> --algorithm <algorithm>\n\n");
             printf("Options:\n");
             printf("-i, --input <input>         path to the input aar\n");
             printf("-o, --output <output>       path to the output aar\n");
             printf("-f, --file <file>           path to the file to add\n");
-            printf("-a, --algorithm <algorithm> compression algorithm of aar\n\n");
+            printf("-a, --algorithm <algorithm> compression algorithm of aar\n");
+            printf("-t, --seek-table            embed a seek table in the output aar\n");
+            printf("-d, --drop-cache            drop what was read and written from the page cache\n\n");
         } else if (NEOAA_CMD_WRAP == neoaaCommand) {
             printf("Usage: neoaa wrap --input <input> --output <output> --algorithm <algorithm>\n\n");
             printf("Options:\n");
             printf("-i, --input <input>         path to the input file to wrap\n");
             printf("-o, --output <output>       path to the output aar\n");
-            printf("-a, --algorithm <algorithm> compression algorithm of aar\n\n");
+            printf("-a, --algorithm <algorithm> compression algorithm of aar\n");
+            printf("-t, --seek-table            embed a seek table in the output aar\n");
+            printf("-d, --drop-cache            drop what was read and written from the page cache\n\n");
         } else if (NEOAA_CMD_UNWRAP == neoaaCommand) {
             printf("Usage: neoaa unwrap --input <input> --output <output> --path <path>\n\n");
             printf("Options:\n");
             printf("-i, --input <input>    path to the input aar to unwrap\n");
-            printf("-o, --output <output>  path to the output file from the aar\n");
-            printf("-p, --path <path>      path of the file in the aar to unwrap\n\n");
+            printf("-o, --output <output>  path to the output file from the aar, or\n");
+            printf("                       output directory if unwrapping multiple files\n");
+            printf("-p, --path <path>      path of the file in the aar to unwrap, can be\n");
+            printf("                       repeated, @file reads one path per line of file\n");
+            printf("-j, --jobs <jobs>      number of threads used to decompress\n");
+            printf("-s, --sparse           leave blocks of zeros in files as holes\n");
+            printf("-d, --drop-cache       drop what was read and written from the page cache\n\n");
+        } else if (NEOAA_CMD_INDEX == neoaaCommand) {
+            printf("Usage: neoaa index --input <input> --output <output>\n\n");
+            printf("Options:\n");
+            printf("-i, --input <input>    path to the input aar to index\n");
+            printf("-o, --output <output>  path to the output index, <input>.idx by default,\n");
+            printf("                       which list, extract -p and unwrap pick up\n");
+            printf("-j, --jobs <jobs>      number of threads used to decompress\n");
+            printf("-d, --drop-cache       drop what was read and written from the page cache\n\n");
+        } else if (NEOAA_CMD_RECOVER == neoaaCommand) {
+            printf("Usage: neoaa recover --input <input> --output <output>\n\n");
+            printf("Options:\n");
+            printf("-i, --input <input>    path to the damaged aar to recover\n");
+            printf("-o, --output <output>  path to the output directory for aar\n");
+            printf("-d, --drop-cache       drop what was read and written from the page cache\n\n");
         } else {
             show_help();
             return 0;
@@ -414,23 +687,32 @@ int main(int argc, const char * argv[]) {
         show_help();
     }
     if (NEOAA_CMD_LIST == neoaaCommand) {
-        list_neo_aa_files(inputPath);
+        list_neo_aa_files(inputPath, threadCount, dropCache);
     } else if (NEOAA_CMD_WRAP == neoaaCommand) {
         if (!outputPath) {
             printf("No -o specified.\n");
             return 0;
         }
-        wrap_file_in_neo_aa(inputPath, outputPath, compress);
+        wrap_file_in_neo_aa(inputPath, outputPath, compress, seekTable, threadCount, dropCache);
     } else if (NEOAA_CMD_UNWRAP == neoaaCommand) {
         if (!outputPath) {
             printf("No -o specified.\n");
+            free(pathSpecifiers);
             return 0;
         }
-        if (!pathSpecifierString) {
+        if (!pathSpecifierCount) {
             printf("No -p specified.\n");
             return 0;
         }
-        unwrap_file_out_of_neo_aa(inputPath, outputPath, pathSpecifierString);
+        int listFileUsed;
+        NeoAAPathSet paths = path_set_from_specifiers(pathSpecifiers, pathSpecifierCount, &listFileUsed);
+        free(pathSpecifiers);
+        if (!paths) {
+            return -1;
+        }
+        int outputIsDirectory = (pathSpecifierCount > 1 || listFileUsed);
+        unwrap_file_out_of_neo_aa(inputPath, outputPath, paths, outputIsDirectory, threadCount, dropCache, sparse);
+        neo_aa_path_set_destroy(paths);
     } else if (NEOAA_CMD_ADD == neoaaCommand) {
         if (!outputPath) {
             printf("No -o specified.\n");
@@ -440,13 +722,47 @@ int main(int argc, const char * argv[]) {
             printf("No -f specified.\n");
             return 0;
         }
-        add_file_in_neo_aa(inputPath, outputPath, fileAddString, compress);
+        add_file_in_neo_aa(inputPath, outputPath, fileAddString, compress, seekTable, threadCount, dropCache);
     } else if (NEOAA_CMD_EXTRACT == neoaaCommand) {
+        if (!outputPath) {
+            printf("No -o specified.\n");
+            free(pathSpecifiers);
+            return 0;
+        }
+        NeoAAPathSet paths = NULL;
+        if (pathSpecifierCount) {
+            /* Only extract the paths given with -p */
+            int listFileUsed;
+            paths = path_set_from_specifiers(pathSpecifiers, pathSpecifierCount, &listFileUsed);
+            free(pathSpecifiers);
+            if (!paths) {
+                return -1;
+            }
+        }
+        int result = extract_neo_aa_to_path(inputPath, outputPath, paths, threadCount, dropCache, ioUring, sparse);
+        neo_aa_path_set_destroy(paths);
+        if (result) {
+            return -1;
+        }
+    } else if (NEOAA_CMD_RECOVER == neoaaCommand) {
         if (!outputPath) {
             printf("No -o specified.\n");
             return 0;
         }
-        neo_aa_extract_aar_to_path(inputPath, outputPath);
+        if (recover_neo_aa_to_path(inputPath, outputPath, dropCache)) {
+            return -1;
+        }
+    } else if (NEOAA_CMD_INDEX == neoaaCommand) {
+        char *indexPath = outputPath ? strdup(outputPath) : neo_aa_index_default_path(inputPath);
+        if (!indexPath) {
+            fprintf(stderr,"Not enough free memory to index archive\n");
+            return -1;
+        }
+        int result = neo_aa_index_write(inputPath, indexPath, threadCount, dropCache);
+        free(indexPath);
+        if (result) {
+            return -1;
+        }
     } else if (NEOAA_CMD_ARCHIVE == neoaaCommand) {
         if (!outputPath) {
             printf("No -o specified.\n");
@@ -459,7 +775,7 @@ int main(int argc, const char * argv[]) {
         }
 
         /* Write the archive */
-        neo_aa_archive_plain_compress_write_path(archive, compress, outputPath);
+        write_neo_aa_archive(archive, compress, outputPath, seekTable, threadCount, dropCache);
         neo_aa_archive_plain_destroy_nozero(archive);
     }
     return 0;
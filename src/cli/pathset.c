@@ -0,0 +1,195 @@
+/*
+ *  pathset.c
+ *  neoaa
+ */
+
+#include "pathset.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct neo_aa_path_set_entry {
+    char *path;
+    size_t length;
+    uint32_t hash;
+    int found;
+};
+
+struct neo_aa_path_set_impl {
+    struct neo_aa_path_set_entry *entries;
+    size_t count;
+    size_t capacity;
+    /* Open addressing table of entry index + 1, 0 is empty */
+    int *table;
+    size_t tableSize;
+    /* Path copies, freed all at once */
+    NeoAAArena arena;
+};
+
+/* FNV-1a */
+__attribute__((visibility ("hidden"))) static uint32_t neo_aa_path_set_hash(const char *path, size_t length) {
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)path[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_path_set_grow_table(NeoAAPathSet set) {
+    size_t tableSize = set->tableSize * 2;
+    int *table = calloc(tableSize, sizeof(int));
+    if (!table) {
+        return -1;
+    }
+    for (size_t i = 0; i < set->count; i++) {
+        size_t slot = set->entries[i].hash & (tableSize - 1);
+        while (table[slot]) {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        table[slot] = (int)i + 1;
+    }
+    free(set->table);
+    set->table = table;
+    set->tableSize = tableSize;
+    return 0;
+}
+
+NeoAAPathSet neo_aa_path_set_create(void) {
+    NeoAAPathSet set = calloc(1, sizeof(struct neo_aa_path_set_impl));
+    if (!set) {
+        return NULL;
+    }
+    set->tableSize = 64;
+    set->table = calloc(set->tableSize, sizeof(int));
+    set->arena = neo_aa_arena_create(0x10000);
+    if (!set->table || !set->arena) {
+        free(set->table);
+        neo_aa_arena_destroy(set->arena);
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void neo_aa_path_set_destroy(NeoAAPathSet set) {
+    if (!set) {
+        return;
+    }
+    neo_aa_arena_destroy(set->arena);
+    free(set->entries);
+    free(set->table);
+    free(set);
+}
+
+int neo_aa_path_set_find(NeoAAPathSet set, const char *path, size_t length) {
+    uint32_t hash = neo_aa_path_set_hash(path, length);
+    size_t slot = hash & (set->tableSize - 1);
+    while (set->table[slot]) {
+        struct neo_aa_path_set_entry *entry = &set->entries[set->table[slot] - 1];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->path, path, length) == 0) {
+            return set->table[slot] - 1;
+        }
+        slot = (slot + 1) & (set->tableSize - 1);
+    }
+    return -1;
+}
+
+int neo_aa_path_set_add(NeoAAPathSet set, const char *path, size_t length) {
+    int index = neo_aa_path_set_find(set, path, length);
+    if (index != -1) {
+        return index;
+    }
+    /* Keep the table at most half full */
+    if ((set->count + 1) * 2 > set->tableSize && neo_aa_path_set_grow_table(set)) {
+        return -1;
+    }
+    if (set->count == set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 16;
+        struct neo_aa_path_set_entry *entries = realloc(set->entries, capacity * sizeof(struct neo_aa_path_set_entry));
+        if (!entries) {
+            return -1;
+        }
+        set->entries = entries;
+        set->capacity = capacity;
+    }
+    char *copy = neo_aa_arena_strndup(set->arena, path, length);
+    if (!copy) {
+        return -1;
+    }
+    struct neo_aa_path_set_entry *entry = &set->entries[set->count];
+    entry->path = copy;
+    entry->length = length;
+    entry->hash = neo_aa_path_set_hash(path, length);
+    entry->found = 0;
+    size_t slot = entry->hash & (set->tableSize - 1);
+    while (set->table[slot]) {
+        slot = (slot + 1) & (set->tableSize - 1);
+    }
+    set->table[slot] = (int)set->count + 1;
+    return (int)set->count++;
+}
+
+int neo_aa_path_set_add_list_file(NeoAAPathSet set, const char *listPath) {
+    FILE *fp = fopen(listPath, "r");
+    if (!fp) {
+        return -1;
+    }
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t length;
+    int result = 0;
+    while ((length = getline(&line, &lineCapacity, fp)) != -1) {
+        while (length && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            length--;
+        }
+        if (!length) {
+            continue;
+        }
+        if (neo_aa_path_set_add(set, line, length) == -1) {
+            result = -1;
+            break;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return result;
+}
+
+int neo_aa_path_set_find_covering(NeoAAPathSet set, const char *path, size_t length) {
+    int index = neo_aa_path_set_find(set, path, length);
+    /* Try every parent directory, deepest first */
+    while (index == -1 && length) {
+        length--;
+        while (length && path[length] != '/') {
+            length--;
+        }
+        if (length) {
+            index = neo_aa_path_set_find(set, path, length);
+        }
+    }
+    return index;
+}
+
+size_t neo_aa_path_set_count(NeoAAPathSet set) {
+    return set->count;
+}
+
+const char *neo_aa_path_set_get_path(NeoAAPathSet set, int index) {
+    return set->entries[index].path;
+}
+
+int neo_aa_path_set_mark_found(NeoAAPathSet set, int index) {
+    if (set->entries[index].found) {
+        return 0;
+    }
+    set->entries[index].found = 1;
+    return 1;
+}
+
+int neo_aa_path_set_is_found(NeoAAPathSet set, int index) {
+    return set->entries[index].found;
+}
@@ -0,0 +1,43 @@
+/*
+ *  pathset.h
+ *  neoaa
+ */
+
+#ifndef neoaa_pathset_h
+#define neoaa_pathset_h
+
+#include <stddef.h>
+
+typedef struct neo_aa_path_set_impl *NeoAAPathSet;
+
+/*
+ * NeoAAPathSet is a hash set of archive paths, used to look up
+ * the PAT of every entry against many requested paths at once.
+ * Paths are stored in insertion order and addressed by index.
+ */
+NeoAAPathSet neo_aa_path_set_create(void);
+void neo_aa_path_set_destroy(NeoAAPathSet set);
+
+/* Returns the index of path, adding it if it is not in the set yet */
+int neo_aa_path_set_add(NeoAAPathSet set, const char *path, size_t length);
+
+/* Adds every non empty line of the file at listPath */
+int neo_aa_path_set_add_list_file(NeoAAPathSet set, const char *listPath);
+
+/* Returns the index of path or -1 if it is not in the set */
+int neo_aa_path_set_find(NeoAAPathSet set, const char *path, size_t length);
+
+/*
+ * Returns the index of path or of the deepest of its parent
+ * directories in the set, or -1 if none of them are in it.
+ */
+int neo_aa_path_set_find_covering(NeoAAPathSet set, const char *path, size_t length);
+
+size_t neo_aa_path_set_count(NeoAAPathSet set);
+const char *neo_aa_path_set_get_path(NeoAAPathSet set, int index);
+
+/* Returns 1 if the path at index was not marked as found before */
+int neo_aa_path_set_mark_found(NeoAAPathSet set, int index);
+int neo_aa_path_set_is_found(NeoAAPathSet set, int index);
+
+#endif /* neoaa_pathset_h */
@@ -0,0 +1,66 @@
+/*
+ *  reader.c
+ *  neoaa
+ */
+
+#include "reader.h"
+#include <string.h>
+#include <unistd.h>
+
+NeoAAReader neo_aa_reader_open(const char *path) {
+    return neo_aa_stream_open(path);
+}
+
+NeoAAReader neo_aa_reader_open_fd(int fd) {
+    return neo_aa_stream_open_fd(fd);
+}
+
+NeoAAReader neo_aa_reader_open_input(const char *inputPath) {
+    if (strcmp(inputPath, "-") == 0) {
+        return neo_aa_stream_open_fd(STDIN_FILENO);
+    }
+    return neo_aa_stream_open(inputPath);
+}
+
+void neo_aa_reader_close(NeoAAReader reader) {
+    neo_aa_stream_close(reader);
+}
+
+int neo_aa_reader_next(NeoAAReader reader) {
+    return neo_aa_stream_next_header(reader);
+}
+
+const char *neo_aa_reader_get_path(NeoAAReader reader, size_t *length) {
+    int patIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_PAT);
+    return neo_aa_stream_get_field_string_view(reader, patIndex, length);
+}
+
+char neo_aa_reader_get_type(NeoAAReader reader) {
+    int typIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_TYP);
+    return typIndex != -1 ? (char)neo_aa_stream_get_field_uint(reader, typIndex) : 0;
+}
+
+uint64_t neo_aa_reader_get_size(NeoAAReader reader) {
+    int datIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_DAT);
+    return neo_aa_stream_get_field_blob_size(reader, datIndex);
+}
+
+ssize_t neo_aa_reader_read(NeoAAReader reader, void *buffer, size_t size) {
+    int datIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_DAT);
+    if (datIndex == -1) {
+        return 0;
+    }
+    return neo_aa_stream_read_field_blob(reader, datIndex, buffer, size);
+}
+
+int neo_aa_reader_skip(NeoAAReader reader) {
+    return neo_aa_stream_skip_blobs(reader);
+}
+
+int neo_aa_reader_copy_to_fd(NeoAAReader reader, int fd) {
+    int datIndex = neo_aa_stream_get_known_field_index(reader, NEOAA_STREAM_FIELD_DAT);
+    if (datIndex == -1) {
+        return 0;
+    }
+    return neo_aa_stream_write_blob_to_fd(reader, datIndex, fd);
+}
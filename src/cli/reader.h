@@ -0,0 +1,54 @@
+/*
+ *  reader.h
+ *  neoaa
+ */
+
+#ifndef neoaa_reader_h
+#define neoaa_reader_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "stream.h"
+
+/*
+ * NeoAAReader is a cursor over the entries of an archive, for
+ * processing archives larger than memory. Open it on a path or fd,
+ * call neo_aa_reader_next() for the header of each entry, then read
+ * its DAT in chunks, copy it to an fd, or just move on to the next
+ * entry which skips it. A reader is a NeoAAStream, so every
+ * neo_aa_stream_get_field_*() accessor works on it too.
+ */
+typedef NeoAAStream NeoAAReader;
+
+NeoAAReader neo_aa_reader_open(const char *path);
+
+/* fd may be a pipe, it is not closed by neo_aa_reader_close() */
+NeoAAReader neo_aa_reader_open_fd(int fd);
+
+/* Opens inputPath, or standard input if inputPath is - */
+NeoAAReader neo_aa_reader_open_input(const char *inputPath);
+
+void neo_aa_reader_close(NeoAAReader reader);
+
+/* Returns 1 for the next entry, 0 at the end of the archive and -1 on error */
+int neo_aa_reader_next(NeoAAReader reader);
+
+/*
+ * Accessors for the current entry. The path is not NUL terminated
+ * and is valid until the next entry, NULL if the entry has no PAT.
+ */
+const char *neo_aa_reader_get_path(NeoAAReader reader, size_t *length);
+char neo_aa_reader_get_type(NeoAAReader reader);
+uint64_t neo_aa_reader_get_size(NeoAAReader reader);
+
+/* Reads the DAT of the current entry, 0 once it has all been read */
+ssize_t neo_aa_reader_read(NeoAAReader reader, void *buffer, size_t size);
+
+/* Skips the rest of the blobs of the current entry */
+int neo_aa_reader_skip(NeoAAReader reader);
+
+/* Writes the DAT of the current entry to fd, a new or truncated file */
+int neo_aa_reader_copy_to_fd(NeoAAReader reader, int fd);
+
+#endif /* neoaa_reader_h */
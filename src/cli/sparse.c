@@ -0,0 +1,189 @@
+/*
+ *  sparse.c
+ *  neoaa
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* SEEK_DATA and SEEK_HOLE */
+#define _GNU_SOURCE
+#endif
+
+#include "sparse.h"
+#include "copy.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Holes are made of whole blocks of this size aligned to the file,
+ * the smallest a filesystem leaves unallocated.
+ */
+#define NEOAA_SPARSE_BLOCK_SIZE 0x1000
+
+ssize_t neo_aa_sparse_read(int fd, void *data, size_t size) {
+    uint8_t *bytes = data;
+    size_t position = 0;
+    while (position < size) {
+        size_t end = size;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        off_t dataStart = lseek(fd, (off_t)position, SEEK_DATA);
+        if (dataStart == -1 && errno == ENXIO) {
+            /* Nothing but a hole up to the end of the file */
+            memset(bytes + position, 0, size - position);
+            return size;
+        }
+        if (dataStart != -1) {
+            if ((size_t)dataStart > size) {
+                dataStart = size;
+            }
+            memset(bytes + position, 0, dataStart - position);
+            position = dataStart;
+            off_t holeStart = lseek(fd, (off_t)position, SEEK_HOLE);
+            if (holeStart != -1 && (size_t)holeStart < size) {
+                end = holeStart;
+            }
+        }
+        /* Otherwise the filesystem can not tell, read the rest */
+#endif
+        while (position < end) {
+            ssize_t bytesRead = pread(fd, bytes + position, end - position, (off_t)position);
+            if (bytesRead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            if (bytesRead == 0) {
+                return position;
+            }
+            position += bytesRead;
+        }
+    }
+    return position;
+}
+
+/*
+ * Checks a whole block 64 bytes at a time. The first word is
+ * checked on its own so blocks of data bail out at once, the rest
+ * is OR-ed together in a loop the compiler vectorizes.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_sparse_is_zero(const uint8_t *block) {
+    uint64_t word;
+    memcpy(&word, block, sizeof(word));
+    if (word) {
+        return 0;
+    }
+    for (size_t i = 0; i < NEOAA_SPARSE_BLOCK_SIZE; i += 64) {
+        uint64_t words[8];
+        memcpy(words, block + i, sizeof(words));
+        if (words[0] | words[1] | words[2] | words[3] | words[4] | words[5] | words[6] | words[7]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Returns where the first run of zero blocks at or after position
+ * starts and sets holeEnd to where it ends, or returns size if
+ * data has none. data starts at fileOffset into the file. With
+ * keepLast a run at the end leaves out the last byte, so writing
+ * it extends the file over the hole.
+ */
+__attribute__((visibility ("hidden"))) static uint64_t neo_aa_sparse_find_hole(const uint8_t *data, uint64_t size, uint64_t position, uint64_t fileOffset, int keepLast, uint64_t *holeEnd) {
+    uint64_t block = ((fileOffset + position + NEOAA_SPARSE_BLOCK_SIZE - 1) & ~(uint64_t)(NEOAA_SPARSE_BLOCK_SIZE - 1)) - fileOffset;
+    for (; block + NEOAA_SPARSE_BLOCK_SIZE <= size; block += NEOAA_SPARSE_BLOCK_SIZE) {
+        if (!neo_aa_sparse_is_zero(data + block)) {
+            continue;
+        }
+        uint64_t end = block + NEOAA_SPARSE_BLOCK_SIZE;
+        while (end + NEOAA_SPARSE_BLOCK_SIZE <= size && neo_aa_sparse_is_zero(data + end)) {
+            end += NEOAA_SPARSE_BLOCK_SIZE;
+        }
+        if (keepLast && end == size) {
+            end--;
+        }
+        *holeEnd = end;
+        return block;
+    }
+    return size;
+}
+
+int neo_aa_sparse_has_hole(const void *data, uint64_t size) {
+    uint64_t holeEnd;
+    return neo_aa_sparse_find_hole(data, size, 0, 0, 0, &holeEnd) != size;
+}
+
+/* Writes a run of data at the current offset of outFd */
+__attribute__((visibility ("hidden"))) static int neo_aa_sparse_write_run(int inFd, uint64_t offset, const uint8_t *data, uint64_t size, int outFd) {
+    if (inFd != -1) {
+        return neo_aa_copy_range(inFd, offset, data, size, outFd);
+    }
+    while (size) {
+        ssize_t bytesWritten = write(outFd, data, size);
+        if (bytesWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += bytesWritten;
+        size -= bytesWritten;
+    }
+    return 0;
+}
+
+int neo_aa_sparse_write(int inFd, uint64_t offset, const void *data, uint64_t size, int outFd, uint64_t fileOffset) {
+    const uint8_t *bytes = data;
+    uint64_t position = 0;
+    while (position < size) {
+        uint64_t holeEnd;
+        uint64_t holeStart = neo_aa_sparse_find_hole(bytes, size, position, fileOffset, 0, &holeEnd);
+        if (holeStart > position && neo_aa_sparse_write_run(inFd, offset + position, bytes + position, holeStart - position, outFd)) {
+            return -1;
+        }
+        if (holeStart == size) {
+            break;
+        }
+        if (lseek(outFd, (off_t)(holeEnd - holeStart), SEEK_CUR) == -1) {
+            return -1;
+        }
+        position = holeEnd;
+        if (position == size) {
+            /* Seeking does not extend the file over a hole at its end */
+            struct stat st;
+            off_t end = (off_t)(fileOffset + size);
+            if ((fstat(outFd, &st) || st.st_size < end) && ftruncate(outFd, end)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int neo_aa_sparse_write_at(int inFd, uint64_t offset, const void *data, uint64_t size, int outFd, uint64_t outOffset) {
+    const uint8_t *bytes = data;
+    uint64_t position = 0;
+    while (position < size) {
+        uint64_t holeEnd;
+        /* Other writers may be extending the file, so it can not be truncated to size */
+        uint64_t holeStart = neo_aa_sparse_find_hole(bytes, size, position, outOffset, 1, &holeEnd);
+        if (holeStart > position) {
+            int failed;
+            if (inFd != -1) {
+                failed = neo_aa_copy_range_at(inFd, offset + position, bytes + position, holeStart - position, outFd, outOffset + position);
+            } else {
+                failed = neo_aa_copy_pwrite(bytes + position, holeStart - position, outFd, outOffset + position);
+            }
+            if (failed) {
+                return -1;
+            }
+        }
+        if (holeStart == size) {
+            break;
+        }
+        position = holeEnd;
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+ *  sparse.h
+ *  neoaa
+ */
+
+#ifndef neoaa_sparse_h
+#define neoaa_sparse_h
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Reads the first size bytes of fd into data. Only the ranges
+ * SEEK_DATA finds are read, the holes of sparse files are zero
+ * filled in memory instead of being read from the filesystem.
+ * Returns the number of bytes read, short if fd ended early, or
+ * -1 on error.
+ */
+ssize_t neo_aa_sparse_read(int fd, void *data, size_t size);
+
+/*
+ * Returns 1 if data, written from the start of a file, has a block
+ * of zeros neo_aa_sparse_write() would leave as a hole.
+ */
+int neo_aa_sparse_has_hole(const void *data, uint64_t size);
+
+/*
+ * Writes size bytes of data to outFd at its current offset, which
+ * is fileOffset into the file. Blocks of the file data leaves all
+ * zero are seeked over rather than written, so they are left as
+ * holes. outFd must be a new or truncated file that was not
+ * preallocated, or the holes would not read back as zeros or would
+ * still take up space. The rest is copied from offset of inFd like
+ * neo_aa_copy_range(), or written from data if inFd is -1. Returns
+ * 0 on success and -1 on error.
+ */
+int neo_aa_sparse_write(int inFd, uint64_t offset, const void *data, uint64_t size, int outFd, uint64_t fileOffset);
+
+/* Like neo_aa_sparse_write(), but writes at outOffset of outFd */
+int neo_aa_sparse_write_at(int inFd, uint64_t offset, const void *data, uint64_t size, int outFd, uint64_t outOffset);
+
+#endif /* neoaa_sparse_h */
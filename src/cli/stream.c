@@ -0,0 +1,1666 @@
+/*
+ *  stream.c
+ *  neoaa
+ */
+
+#include "stream.h"
+#include "advise.h"
+#include "buffer.h"
+#include "copy.h"
+#include "sparse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <zlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include <libNeoAppleArchive.h>
+#include <libzbitmap.h>
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wstrict-prototypes"
+#include <lzfse.h>
+#pragma clang diagnostic pop
+
+#define NEOAA_STREAM_INPUT_SIZE 0x10000
+#define NEOAA_STREAM_HEADER_MAX 0x10000
+#define NEOAA_STREAM_CHUNK_SIZE 0x40000
+/* How far ahead of the stream the file is read in, and dropped behind it */
+#define NEOAA_STREAM_ADVISE_WINDOW 0x800000
+
+/* NEOAA_KEY() for case labels */
+#define NEOAA_STREAM_KEY(a, b, c) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16))
+
+/* neo_aa_stream_subtype_sizes entry of the P subtype */
+#define NEOAA_STREAM_SUBTYPE_STRING 0xff
+
+struct neo_aa_stream_field {
+    uint32_t key;
+    char subtype;
+    uint16_t valueOffset;
+    uint16_t valueSize;
+    uint64_t blobSize;
+    uint64_t blobOffset;
+};
+
+enum {
+    NEOAA_STREAM_JOB_PENDING,
+    NEOAA_STREAM_JOB_WORKING,
+    NEOAA_STREAM_JOB_DONE,
+    NEOAA_STREAM_JOB_FAILED,
+};
+
+/* Decompression state of one thread, reused for every block it decompresses */
+struct neo_aa_stream_decoder {
+    void *lzfseScratch;
+    z_stream zs;
+    /* windowBits zs was initialized with, 0 if it was not */
+    int zsWindowBits;
+};
+
+struct neo_aa_stream_job {
+    uint8_t *compressed;
+    size_t compressedCapacity;
+    size_t compressedSize;
+    uint8_t *block;
+    size_t blockCapacity;
+    size_t blockSize;
+    int state;
+};
+
+struct neo_aa_stream_pool {
+    pthread_t *threads;
+    int threadCount;
+    struct neo_aa_stream_job *jobs;
+    uint64_t jobCount;
+    /* Counters of blocks submitted, taken by a worker and consumed */
+    uint64_t submitted;
+    uint64_t taken;
+    uint64_t consumed;
+    int holding;
+    int inputEnded;
+    int shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t jobReady;
+    pthread_cond_t jobDone;
+};
+
+struct neo_aa_stream_impl {
+    int fd;
+    int ownsFd;
+    /* Pipes can not be seeked, skipped data is read instead */
+    int seekable;
+    int compression;
+    uint64_t fileSize;
+    uint64_t position;
+    /* Raw archives are mapped instead of read when possible */
+    uint8_t *map;
+    /* File offsets up to which read ahead was asked for and the cache was dropped */
+    uint64_t adviseOffset;
+    uint64_t dropOffset;
+    int dropCache;
+    /* Zero blocks of written blobs are left as holes */
+    int sparse;
+    /* Buffered input from fd */
+    uint8_t *input;
+    size_t inputPos;
+    size_t inputLen;
+    /* Compressed archives only */
+    uint64_t blockSize;
+    uint8_t *blockData;
+    uint8_t *block;
+    size_t blockCapacity;
+    size_t blockPos;
+    size_t blockLen;
+    uint8_t *compressedBlock;
+    size_t compressedBlockCapacity;
+    struct neo_aa_stream_decoder decoder;
+    /* Offsets in the plain stream of the reader and current block */
+    uint64_t plainPosition;
+    uint64_t blockPlainStart;
+    /* Offset in the file of the header of the current block */
+    uint64_t blockFileOffset;
+    /* Set once a block could not be read, until neo_aa_stream_resync() */
+    int blockDamaged;
+    /* Compressed archives are mapped to search for blocks to resync to */
+    uint8_t *scanMap;
+    /* Current header */
+    uint8_t header[NEOAA_STREAM_HEADER_MAX];
+    size_t headerSize;
+    uint64_t headerOffset;
+    struct neo_aa_stream_field *fields;
+    int fieldCount;
+    int fieldCapacity;
+    /* Index + 1 of every known field in the current header, 0 if missing */
+    int knownFields[NEOAA_STREAM_FIELD_COUNT];
+    /*
+     * Fields are decoded lazily, parsePos is where decoding stopped
+     * and parseBlobOffset the blob offset of the field there.
+     */
+    size_t parsePos;
+    uint64_t parseBlobOffset;
+    int blobsCounted;
+    uint64_t blobRemaining;
+    uint64_t blobConsumed;
+    uint64_t blobLeft;
+    /* Field whose blob is being read, -1 if none */
+    int blobIndex;
+    uint8_t *chunk;
+    struct neo_aa_stream_pool *pool;
+};
+
+__attribute__((visibility ("hidden"))) static uint64_t neo_aa_stream_le(const uint8_t *bytes, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t)bytes[i] << (i * 8);
+    }
+    return value;
+}
+
+/* Key of every NeoAAStreamField */
+static const uint32_t neo_aa_stream_known_keys[NEOAA_STREAM_FIELD_COUNT] = {
+    [NEOAA_STREAM_FIELD_TYP] = NEOAA_STREAM_KEY('T', 'Y', 'P'),
+    [NEOAA_STREAM_FIELD_PAT] = NEOAA_STREAM_KEY('P', 'A', 'T'),
+    [NEOAA_STREAM_FIELD_LNK] = NEOAA_STREAM_KEY('L', 'N', 'K'),
+    [NEOAA_STREAM_FIELD_DEV] = NEOAA_STREAM_KEY('D', 'E', 'V'),
+    [NEOAA_STREAM_FIELD_INO] = NEOAA_STREAM_KEY('I', 'N', 'O'),
+    [NEOAA_STREAM_FIELD_NLK] = NEOAA_STREAM_KEY('N', 'L', 'K'),
+    [NEOAA_STREAM_FIELD_UID] = NEOAA_STREAM_KEY('U', 'I', 'D'),
+    [NEOAA_STREAM_FIELD_GID] = NEOAA_STREAM_KEY('G', 'I', 'D'),
+    [NEOAA_STREAM_FIELD_MOD] = NEOAA_STREAM_KEY('M', 'O', 'D'),
+    [NEOAA_STREAM_FIELD_FLG] = NEOAA_STREAM_KEY('F', 'L', 'G'),
+    [NEOAA_STREAM_FIELD_MTM] = NEOAA_STREAM_KEY('M', 'T', 'M'),
+    [NEOAA_STREAM_FIELD_CTM] = NEOAA_STREAM_KEY('C', 'T', 'M'),
+    [NEOAA_STREAM_FIELD_BTM] = NEOAA_STREAM_KEY('B', 'T', 'M'),
+    [NEOAA_STREAM_FIELD_DAT] = NEOAA_STREAM_KEY('D', 'A', 'T'),
+    [NEOAA_STREAM_FIELD_SIZ] = NEOAA_STREAM_KEY('S', 'I', 'Z'),
+    [NEOAA_STREAM_FIELD_XAT] = NEOAA_STREAM_KEY('X', 'A', 'T'),
+    [NEOAA_STREAM_FIELD_ACL] = NEOAA_STREAM_KEY('A', 'C', 'L'),
+    [NEOAA_STREAM_FIELD_CKS] = NEOAA_STREAM_KEY('C', 'K', 'S'),
+    [NEOAA_STREAM_FIELD_SH1] = NEOAA_STREAM_KEY('S', 'H', '1'),
+    [NEOAA_STREAM_FIELD_SH2] = NEOAA_STREAM_KEY('S', 'H', '2'),
+    [NEOAA_STREAM_FIELD_SH3] = NEOAA_STREAM_KEY('S', 'H', '3'),
+    [NEOAA_STREAM_FIELD_SH5] = NEOAA_STREAM_KEY('S', 'H', '5'),
+    [NEOAA_STREAM_FIELD_IDX] = NEOAA_STREAM_KEY('I', 'D', 'X'),
+    [NEOAA_STREAM_FIELD_IDZ] = NEOAA_STREAM_KEY('I', 'D', 'Z'),
+    [NEOAA_STREAM_FIELD_HLC] = NEOAA_STREAM_KEY('H', 'L', 'C'),
+    [NEOAA_STREAM_FIELD_CLC] = NEOAA_STREAM_KEY('C', 'L', 'C'),
+    [NEOAA_STREAM_FIELD_AFT] = NEOAA_STREAM_KEY('A', 'F', 'T'),
+    [NEOAA_STREAM_FIELD_AFR] = NEOAA_STREAM_KEY('A', 'F', 'R'),
+    [NEOAA_STREAM_FIELD_YEC] = NEOAA_STREAM_KEY('Y', 'E', 'C'),
+    [NEOAA_STREAM_FIELD_LBL] = NEOAA_STREAM_KEY('L', 'B', 'L'),
+};
+
+/* Returns the NeoAAStreamField of key, or -1 if it is not a known field */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_known_field(uint32_t key) {
+    switch (key) {
+        case NEOAA_STREAM_KEY('T', 'Y', 'P'):
+            return NEOAA_STREAM_FIELD_TYP;
+        case NEOAA_STREAM_KEY('P', 'A', 'T'):
+            return NEOAA_STREAM_FIELD_PAT;
+        case NEOAA_STREAM_KEY('L', 'N', 'K'):
+            return NEOAA_STREAM_FIELD_LNK;
+        case NEOAA_STREAM_KEY('D', 'E', 'V'):
+            return NEOAA_STREAM_FIELD_DEV;
+        case NEOAA_STREAM_KEY('I', 'N', 'O'):
+            return NEOAA_STREAM_FIELD_INO;
+        case NEOAA_STREAM_KEY('N', 'L', 'K'):
+            return NEOAA_STREAM_FIELD_NLK;
+        case NEOAA_STREAM_KEY('U', 'I', 'D'):
+            return NEOAA_STREAM_FIELD_UID;
+        case NEOAA_STREAM_KEY('G', 'I', 'D'):
+            return NEOAA_STREAM_FIELD_GID;
+        case NEOAA_STREAM_KEY('M', 'O', 'D'):
+            return NEOAA_STREAM_FIELD_MOD;
+        case NEOAA_STREAM_KEY('F', 'L', 'G'):
+            return NEOAA_STREAM_FIELD_FLG;
+        case NEOAA_STREAM_KEY('M', 'T', 'M'):
+            return NEOAA_STREAM_FIELD_MTM;
+        case NEOAA_STREAM_KEY('C', 'T', 'M'):
+            return NEOAA_STREAM_FIELD_CTM;
+        case NEOAA_STREAM_KEY('B', 'T', 'M'):
+            return NEOAA_STREAM_FIELD_BTM;
+        case NEOAA_STREAM_KEY('D', 'A', 'T'):
+            return NEOAA_STREAM_FIELD_DAT;
+        case NEOAA_STREAM_KEY('S', 'I', 'Z'):
+            return NEOAA_STREAM_FIELD_SIZ;
+        case NEOAA_STREAM_KEY('X', 'A', 'T'):
+            return NEOAA_STREAM_FIELD_XAT;
+        case NEOAA_STREAM_KEY('A', 'C', 'L'):
+            return NEOAA_STREAM_FIELD_ACL;
+        case NEOAA_STREAM_KEY('C', 'K', 'S'):
+            return NEOAA_STREAM_FIELD_CKS;
+        case NEOAA_STREAM_KEY('S', 'H', '1'):
+            return NEOAA_STREAM_FIELD_SH1;
+        case NEOAA_STREAM_KEY('S', 'H', '2'):
+            return NEOAA_STREAM_FIELD_SH2;
+        case NEOAA_STREAM_KEY('S', 'H', '3'):
+            return NEOAA_STREAM_FIELD_SH3;
+        case NEOAA_STREAM_KEY('S', 'H', '5'):
+            return NEOAA_STREAM_FIELD_SH5;
+        case NEOAA_STREAM_KEY('I', 'D', 'X'):
+            return NEOAA_STREAM_FIELD_IDX;
+        case NEOAA_STREAM_KEY('I', 'D', 'Z'):
+            return NEOAA_STREAM_FIELD_IDZ;
+        case NEOAA_STREAM_KEY('H', 'L', 'C'):
+            return NEOAA_STREAM_FIELD_HLC;
+        case NEOAA_STREAM_KEY('C', 'L', 'C'):
+            return NEOAA_STREAM_FIELD_CLC;
+        case NEOAA_STREAM_KEY('A', 'F', 'T'):
+            return NEOAA_STREAM_FIELD_AFT;
+        case NEOAA_STREAM_KEY('A', 'F', 'R'):
+            return NEOAA_STREAM_FIELD_AFR;
+        case NEOAA_STREAM_KEY('Y', 'E', 'C'):
+            return NEOAA_STREAM_FIELD_YEC;
+        case NEOAA_STREAM_KEY('L', 'B', 'L'):
+            return NEOAA_STREAM_FIELD_LBL;
+        default:
+            return -1;
+    }
+}
+
+__attribute__((visibility ("hidden"))) static uint64_t neo_aa_stream_be64(const uint8_t *bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+/* Ensure at least size bytes are buffered if the file has them */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_input_fill(NeoAAStream stream, size_t size) {
+    if (stream->inputLen - stream->inputPos >= size) {
+        return 0;
+    }
+    memmove(stream->input, stream->input + stream->inputPos, stream->inputLen - stream->inputPos);
+    stream->inputLen -= stream->inputPos;
+    stream->inputPos = 0;
+    while (stream->inputLen < size) {
+        ssize_t bytesRead = read(stream->fd, stream->input + stream->inputLen, NEOAA_STREAM_INPUT_SIZE - stream->inputLen);
+        if (bytesRead < 0) {
+            return -1;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        stream->inputLen += bytesRead;
+    }
+    return 0;
+}
+
+/* Returns the amount of bytes read, less than size at EOF, -1 on error */
+__attribute__((visibility ("hidden"))) static ssize_t neo_aa_stream_input_read(NeoAAStream stream, void *buffer, size_t size) {
+    if (stream->map) {
+        if (size > stream->fileSize - stream->position) {
+            size = stream->fileSize - stream->position;
+        }
+        memcpy(buffer, stream->map + stream->position, size);
+        stream->position += size;
+        return size;
+    }
+    uint8_t *out = buffer;
+    size_t done = 0;
+    size_t buffered = stream->inputLen - stream->inputPos;
+    if (buffered) {
+        done = buffered < size ? buffered : size;
+        memcpy(out, stream->input + stream->inputPos, done);
+        stream->inputPos += done;
+    }
+    if (size - done >= NEOAA_STREAM_INPUT_SIZE) {
+        /* Large reads bypass the input buffer */
+        while (done < size) {
+            ssize_t bytesRead = read(stream->fd, out + done, size - done);
+            if (bytesRead < 0) {
+                return -1;
+            }
+            if (bytesRead == 0) {
+                break;
+            }
+            done += bytesRead;
+        }
+    } else if (done < size) {
+        if (neo_aa_stream_input_fill(stream, size - done)) {
+            return -1;
+        }
+        size_t chunk = stream->inputLen - stream->inputPos;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        memcpy(out + done, stream->input + stream->inputPos, chunk);
+        stream->inputPos += chunk;
+        done += chunk;
+    }
+    stream->position += done;
+    return done;
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_input_skip(NeoAAStream stream, uint64_t size) {
+    if (size > stream->fileSize - stream->position) {
+        /* Skipping past the end means the archive is truncated */
+        return -1;
+    }
+    if (stream->map) {
+        stream->position += size;
+        return 0;
+    }
+    if (!stream->seekable) {
+        uint64_t left = size;
+        while (left) {
+            if (stream->inputPos == stream->inputLen) {
+                ssize_t bytesRead = read(stream->fd, stream->input, NEOAA_STREAM_INPUT_SIZE);
+                if (bytesRead <= 0) {
+                    return -1;
+                }
+                stream->inputPos = 0;
+                stream->inputLen = bytesRead;
+            }
+            size_t chunk = stream->inputLen - stream->inputPos;
+            if (chunk > left) {
+                chunk = left;
+            }
+            stream->inputPos += chunk;
+            left -= chunk;
+        }
+        stream->position += size;
+        return 0;
+    }
+    size_t buffered = stream->inputLen - stream->inputPos;
+    if (size <= buffered) {
+        stream->inputPos += size;
+    } else {
+        if (lseek(stream->fd, size - buffered, SEEK_CUR) == -1) {
+            return -1;
+        }
+        stream->inputPos = 0;
+        stream->inputLen = 0;
+    }
+    stream->position += size;
+    return 0;
+}
+
+__attribute__((visibility ("hidden"))) static void neo_aa_stream_decoder_free(struct neo_aa_stream_decoder *decoder) {
+    free(decoder->lzfseScratch);
+    if (decoder->zsWindowBits) {
+        inflateEnd(&decoder->zs);
+    }
+}
+
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_decompress_block(int compression, struct neo_aa_stream_decoder *decoder, uint8_t *dst, size_t dstSize, uint8_t *src, size_t srcSize) {
+    if (compression == NEO_AA_COMPRESSION_LZFSE) {
+        if (!decoder->lzfseScratch) {
+            /* lzfse allocates scratch for every block itself if this fails */
+            decoder->lzfseScratch = malloc(lzfse_decode_scratch_size());
+        }
+        return lzfse_decode_buffer(dst, dstSize, src, srcSize, decoder->lzfseScratch) == dstSize ? 0 : -1;
+    } else if (compression == NEO_AA_COMPRESSION_ZLIB) {
+        /* Apple's zlib is raw deflate, but accept zlib wrapped blocks too */
+        int windowBits = -15;
+        if (srcSize >= 2 && (src[0] & 0x0F) == 8 && ((src[0] << 8) | src[1]) % 31 == 0) {
+            windowBits = 15;
+        }
+        z_stream *zs = &decoder->zs;
+        if (!decoder->zsWindowBits) {
+            memset(zs, 0, sizeof(z_stream));
+            if (inflateInit2(zs, windowBits) != Z_OK) {
+                return -1;
+            }
+            decoder->zsWindowBits = windowBits;
+        } else if (inflateReset2(zs, windowBits) != Z_OK) {
+            return -1;
+        } else {
+            decoder->zsWindowBits = windowBits;
+        }
+        zs->next_in = src;
+        zs->avail_in = (uInt)srcSize;
+        zs->next_out = dst;
+        zs->avail_out = (uInt)dstSize;
+        int ret = inflate(zs, Z_FINISH);
+        return (ret == Z_STREAM_END && zs->total_out == dstSize) ? 0 : -1;
+    } else if (compression == NEO_AA_COMPRESSION_LZBITMAP) {
+        size_t outLen = 0;
+        if (zbm_decompress(dst, dstSize, src, srcSize, &outLen) < 0) {
+            return -1;
+        }
+        return outLen == dstSize ? 0 : -1;
+    }
+    return -1;
+}
+
+/*
+ * Makes buffer hold at least size bytes, dropping its contents.
+ * No block is larger than the block size in the stream header, so
+ * buffers are allocated at the block size once instead of growing
+ * with every larger block.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_reserve(uint8_t **buffer, size_t *capacity, uint64_t size, uint64_t blockSize) {
+    if (size <= *capacity) {
+        return 0;
+    }
+    neo_aa_buffer_free(*buffer, *capacity);
+    *buffer = NULL;
+    *capacity = 0;
+    uint64_t allocSize = blockSize > size ? blockSize : size;
+    uint8_t *newBuffer = neo_aa_buffer_alloc(allocSize);
+    if (!newBuffer && allocSize != size) {
+        /* Block size of a damaged header may be too large to allocate */
+        allocSize = size;
+        newBuffer = neo_aa_buffer_alloc(allocSize);
+    }
+    if (!newBuffer) {
+        return -1;
+    }
+    *buffer = newBuffer;
+    *capacity = allocSize;
+    return 0;
+}
+
+/*
+ * Reads the uncompressed and compressed size of the next
+ * block. Returns 1 on success, 0 at EOF, -1 on error.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_block_header(NeoAAStream stream, uint64_t *uncompressedSize, uint64_t *compressedSize) {
+    uint8_t blockHeader[16];
+    ssize_t bytesRead = neo_aa_stream_input_read(stream, blockHeader, 16);
+    if (bytesRead == 0) {
+        return 0;
+    }
+    if (bytesRead != 16) {
+        return -1;
+    }
+    *uncompressedSize = neo_aa_stream_be64(blockHeader);
+    *compressedSize = neo_aa_stream_be64(blockHeader + 8);
+    if (*uncompressedSize > stream->blockSize || *compressedSize > *uncompressedSize) {
+        fprintf(stderr,"Corrupted compressed block\n");
+        return -1;
+    }
+    return 1;
+}
+
+/* Reads the payload of a block into buffer, growing it if needed */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_block_payload(NeoAAStream stream, uint8_t **buffer, size_t *capacity, uint64_t size) {
+    if (neo_aa_stream_reserve(buffer, capacity, size, stream->blockSize)) {
+        return -1;
+    }
+    return neo_aa_stream_input_read(stream, *buffer, size) == (ssize_t)size ? 0 : -1;
+}
+
+__attribute__((visibility ("hidden"))) static void *neo_aa_stream_worker(void *arg) {
+    NeoAAStream stream = arg;
+    struct neo_aa_stream_pool *pool = stream->pool;
+    struct neo_aa_stream_decoder decoder;
+    memset(&decoder, 0, sizeof(decoder));
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->shutdown && pool->taken == pool->submitted) {
+            pthread_cond_wait(&pool->jobReady, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        struct neo_aa_stream_job *job = &pool->jobs[pool->taken % pool->jobCount];
+        pool->taken++;
+        if (job->state != NEOAA_STREAM_JOB_PENDING) {
+            /*
+             * Stored blocks are done without a worker, so the slot
+             * may already hold a later block another worker took.
+             */
+            continue;
+        }
+        job->state = NEOAA_STREAM_JOB_WORKING;
+        pthread_mutex_unlock(&pool->lock);
+        int failed = neo_aa_stream_decompress_block(stream->compression, &decoder, job->block, job->blockSize, job->compressed, job->compressedSize);
+        pthread_mutex_lock(&pool->lock);
+        job->state = failed ? NEOAA_STREAM_JOB_FAILED : NEOAA_STREAM_JOB_DONE;
+        pthread_cond_broadcast(&pool->jobDone);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    neo_aa_stream_decoder_free(&decoder);
+    return NULL;
+}
+
+/*
+ * Loads the next block from the worker pool. Blocks are read
+ * from the input in order and queued ahead of the consumer so
+ * up to jobCount blocks are being decompressed at once.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_next_block_pool(NeoAAStream stream) {
+    struct neo_aa_stream_pool *pool = stream->pool;
+    if (pool->holding) {
+        /* Release the block the consumer was reading from */
+        pool->consumed++;
+        pool->holding = 0;
+    }
+    while (!pool->inputEnded && pool->submitted - pool->consumed < pool->jobCount) {
+        struct neo_aa_stream_job *job = &pool->jobs[pool->submitted % pool->jobCount];
+        uint64_t uncompressedSize;
+        uint64_t compressedSize;
+        int status = neo_aa_stream_block_header(stream, &uncompressedSize, &compressedSize);
+        if (status == -1) {
+            return -1;
+        }
+        if (status == 0) {
+            pool->inputEnded = 1;
+            break;
+        }
+        job->blockSize = uncompressedSize;
+        job->compressedSize = compressedSize;
+        if (compressedSize == uncompressedSize) {
+            /* Stored blocks need no worker */
+            if (neo_aa_stream_block_payload(stream, &job->block, &job->blockCapacity, uncompressedSize)) {
+                return -1;
+            }
+            pthread_mutex_lock(&pool->lock);
+            job->state = NEOAA_STREAM_JOB_DONE;
+            pool->submitted++;
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+        if (neo_aa_stream_reserve(&job->block, &job->blockCapacity, uncompressedSize, stream->blockSize)) {
+            return -1;
+        }
+        if (neo_aa_stream_block_payload(stream, &job->compressed, &job->compressedCapacity, compressedSize)) {
+            return -1;
+        }
+        pthread_mutex_lock(&pool->lock);
+        job->state = NEOAA_STREAM_JOB_PENDING;
+        pool->submitted++;
+        pthread_cond_signal(&pool->jobReady);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (pool->consumed == pool->submitted) {
+        return 0;
+    }
+    struct neo_aa_stream_job *job = &pool->jobs[pool->consumed % pool->jobCount];
+    pthread_mutex_lock(&pool->lock);
+    while (job->state == NEOAA_STREAM_JOB_PENDING || job->state == NEOAA_STREAM_JOB_WORKING) {
+        pthread_cond_wait(&pool->jobDone, &pool->lock);
+    }
+    int state = job->state;
+    pthread_mutex_unlock(&pool->lock);
+    if (state == NEOAA_STREAM_JOB_FAILED) {
+        fprintf(stderr,"Failed to decompress block\n");
+        return -1;
+    }
+    pool->holding = 1;
+    stream->blockData = job->block;
+    stream->blockPlainStart = stream->plainPosition;
+    stream->blockPos = 0;
+    stream->blockLen = job->blockSize;
+    return 1;
+}
+
+/*
+ * Loads the next compressed block. If the block is smaller
+ * than or equal to skip, the block is skipped without being
+ * decompressed and its size is stored in skipped.
+ * Returns 1 on success, 0 at EOF, -1 on error.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_next_block(NeoAAStream stream, uint64_t skip, uint64_t *skipped) {
+    *skipped = 0;
+    if (stream->pool) {
+        /* Blocks are decompressed ahead of time, so skip does not apply */
+        return neo_aa_stream_next_block_pool(stream);
+    }
+    if (stream->blockDamaged) {
+        /* Nothing past a damaged block is read until the stream is resynced */
+        return -1;
+    }
+    stream->blockFileOffset = stream->position;
+    uint64_t uncompressedSize;
+    uint64_t compressedSize;
+    int status = neo_aa_stream_block_header(stream, &uncompressedSize, &compressedSize);
+    if (status == -1) {
+        stream->blockDamaged = 1;
+    }
+    if (status != 1) {
+        return status;
+    }
+    if (uncompressedSize <= skip) {
+        /* Entire block is skipped, no need to decompress it */
+        if (neo_aa_stream_input_skip(stream, compressedSize)) {
+            stream->blockDamaged = 1;
+            return -1;
+        }
+        stream->blockPos = 0;
+        stream->blockLen = 0;
+        *skipped = uncompressedSize;
+        return 1;
+    }
+    if (compressedSize == uncompressedSize) {
+        /* Block is stored uncompressed */
+        if (neo_aa_stream_block_payload(stream, &stream->block, &stream->blockCapacity, uncompressedSize)) {
+            stream->blockDamaged = 1;
+            return -1;
+        }
+    } else {
+        if (neo_aa_stream_reserve(&stream->block, &stream->blockCapacity, uncompressedSize, stream->blockSize)) {
+            return -1;
+        }
+        if (neo_aa_stream_block_payload(stream, &stream->compressedBlock, &stream->compressedBlockCapacity, compressedSize)) {
+            stream->blockDamaged = 1;
+            return -1;
+        }
+        if (neo_aa_stream_decompress_block(stream->compression, &stream->decoder, stream->block, uncompressedSize, stream->compressedBlock, compressedSize)) {
+            fprintf(stderr,"Failed to decompress block\n");
+            stream->blockDamaged = 1;
+            return -1;
+        }
+    }
+    stream->blockData = stream->block;
+    stream->blockPlainStart = stream->plainPosition;
+    stream->blockPos = 0;
+    stream->blockLen = uncompressedSize;
+    return 1;
+}
+
+__attribute__((visibility ("hidden"))) static uint64_t neo_aa_stream_get_plain_position(NeoAAStream stream) {
+    if (stream->compression == NEO_AA_COMPRESSION_NONE) {
+        return stream->position;
+    }
+    return stream->plainPosition;
+}
+
+/* Reads from the plain (decompressed) archive stream */
+__attribute__((visibility ("hidden"))) static ssize_t neo_aa_stream_read(NeoAAStream stream, void *buffer, size_t size) {
+    if (stream->compression == NEO_AA_COMPRESSION_NONE) {
+        return neo_aa_stream_input_read(stream, buffer, size);
+    }
+    uint8_t *out = buffer;
+    size_t done = 0;
+    while (done < size) {
+        if (stream->blockPos == stream->blockLen) {
+            uint64_t skipped;
+            int status = neo_aa_stream_next_block(stream, 0, &skipped);
+            if (status == -1) {
+                return -1;
+            }
+            if (status == 0) {
+                break;
+            }
+            continue;
+        }
+        size_t chunk = stream->blockLen - stream->blockPos;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        memcpy(out + done, stream->blockData + stream->blockPos, chunk);
+        stream->blockPos += chunk;
+        stream->plainPosition += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+/* Skips bytes of the plain (decompressed) archive stream */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_skip(NeoAAStream stream, uint64_t size) {
+    if (stream->compression == NEO_AA_COMPRESSION_NONE) {
+        return neo_aa_stream_input_skip(stream, size);
+    }
+    while (size) {
+        size_t buffered = stream->blockLen - stream->blockPos;
+        if (buffered) {
+            size_t chunk = buffered < size ? buffered : size;
+            stream->blockPos += chunk;
+            stream->plainPosition += chunk;
+            size -= chunk;
+            continue;
+        }
+        uint64_t skipped;
+        int status = neo_aa_stream_next_block(stream, size, &skipped);
+        if (status != 1) {
+            /* EOF while skipping means the archive is truncated */
+            return -1;
+        }
+        stream->plainPosition += skipped;
+        size -= skipped;
+    }
+    return 0;
+}
+
+NeoAAStream neo_aa_stream_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    NeoAAStream stream = neo_aa_stream_open_fd(fd);
+    if (!stream) {
+        close(fd);
+        return NULL;
+    }
+    stream->ownsFd = 1;
+    return stream;
+}
+
+/*
+ * Opens a stream on fd. If damaged is set, anything that is not a
+ * compressed archive is read as a raw archive, even if it does not
+ * start with a header.
+ */
+__attribute__((visibility ("hidden"))) static NeoAAStream neo_aa_stream_open_fd_checked(int fd, int damaged) {
+    NeoAAStream stream = calloc(1, sizeof(struct neo_aa_stream_impl));
+    if (!stream) {
+        return NULL;
+    }
+    stream->input = malloc(NEOAA_STREAM_INPUT_SIZE);
+    if (!stream->input) {
+        free(stream);
+        return NULL;
+    }
+    stream->fd = fd;
+    stream->blobIndex = -1;
+    struct stat st;
+    if (fstat(stream->fd, &st) || neo_aa_stream_input_fill(stream, 4)) {
+        neo_aa_stream_close(stream);
+        return NULL;
+    }
+    if (S_ISREG(st.st_mode)) {
+        stream->fileSize = st.st_size;
+        stream->seekable = 1;
+    } else {
+        /* Size of pipes is unknown, read until EOF */
+        stream->fileSize = UINT64_MAX;
+    }
+    if (stream->inputLen < 4) {
+        /* Empty archive */
+        stream->compression = NEO_AA_COMPRESSION_NONE;
+        return stream;
+    }
+    uint8_t *magic = stream->input;
+    if (memcmp(magic, "AA01", 4) == 0 || memcmp(magic, "YAA1", 4) == 0 || (damaged && memcmp(magic, "pbz", 3) != 0)) {
+        stream->compression = NEO_AA_COMPRESSION_NONE;
+        /*
+         * Blobs of raw archives are written straight out of the
+         * mapping, only the pages touched are ever loaded.
+         */
+        void *map = stream->seekable ? mmap(NULL, stream->fileSize, PROT_READ, MAP_PRIVATE, stream->fd, 0) : MAP_FAILED;
+        if (map != MAP_FAILED) {
+            stream->map = map;
+            stream->inputPos = 0;
+            stream->inputLen = 0;
+        }
+        if (stream->seekable) {
+            neo_aa_advise_sequential(stream->fd, stream->map, stream->fileSize);
+        }
+        return stream;
+    }
+    if (memcmp(magic, "pbz", 3) != 0) {
+        fprintf(stderr,"Unknown archive format\n");
+        neo_aa_stream_close(stream);
+        return NULL;
+    }
+    if (magic[3] == 'e') {
+        stream->compression = NEO_AA_COMPRESSION_LZFSE;
+    } else if (magic[3] == 'z') {
+        stream->compression = NEO_AA_COMPRESSION_ZLIB;
+    } else if (magic[3] == 'b') {
+        stream->compression = NEO_AA_COMPRESSION_LZBITMAP;
+    } else {
+        fprintf(stderr,"Unsupported compression algorithm\n");
+        neo_aa_stream_close(stream);
+        return NULL;
+    }
+    uint8_t streamHeader[12];
+    if (neo_aa_stream_input_read(stream, streamHeader, 12) != 12) {
+        neo_aa_stream_close(stream);
+        return NULL;
+    }
+    stream->blockSize = neo_aa_stream_be64(streamHeader + 4);
+    if (stream->seekable) {
+        neo_aa_advise_sequential(stream->fd, NULL, 0);
+    }
+    return stream;
+}
+
+NeoAAStream neo_aa_stream_open_fd(int fd) {
+    return neo_aa_stream_open_fd_checked(fd, 0);
+}
+
+NeoAAStream neo_aa_stream_open_damaged(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    NeoAAStream stream = neo_aa_stream_open_fd_checked(fd, 1);
+    if (!stream) {
+        close(fd);
+        return NULL;
+    }
+    stream->ownsFd = 1;
+    return stream;
+}
+
+void neo_aa_stream_close(NeoAAStream stream) {
+    if (!stream) {
+        return;
+    }
+    struct neo_aa_stream_pool *pool = stream->pool;
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        pool->shutdown = 1;
+        pthread_cond_broadcast(&pool->jobReady);
+        pthread_mutex_unlock(&pool->lock);
+        for (int i = 0; i < pool->threadCount; i++) {
+            pthread_join(pool->threads[i], NULL);
+        }
+        for (uint64_t i = 0; i < pool->jobCount; i++) {
+            neo_aa_buffer_free(pool->jobs[i].compressed, pool->jobs[i].compressedCapacity);
+            neo_aa_buffer_free(pool->jobs[i].block, pool->jobs[i].blockCapacity);
+        }
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->jobReady);
+        pthread_cond_destroy(&pool->jobDone);
+        free(pool->threads);
+        free(pool->jobs);
+        free(pool);
+    }
+    if (stream->map) {
+        munmap(stream->map, stream->fileSize);
+    }
+    if (stream->scanMap) {
+        munmap(stream->scanMap, stream->fileSize);
+    }
+    if (stream->dropCache && stream->seekable) {
+        neo_aa_advise_dontneed(stream->fd, NULL, stream->dropOffset, 0);
+    }
+    if (stream->ownsFd) {
+        close(stream->fd);
+    }
+    free(stream->input);
+    neo_aa_buffer_free(stream->block, stream->blockCapacity);
+    neo_aa_buffer_free(stream->compressedBlock, stream->compressedBlockCapacity);
+    neo_aa_stream_decoder_free(&stream->decoder);
+    free(stream->fields);
+    free(stream->chunk);
+    free(stream);
+}
+
+int neo_aa_stream_get_fd(NeoAAStream stream) {
+    return stream->fd;
+}
+
+int neo_aa_stream_get_compression(NeoAAStream stream) {
+    return stream->compression;
+}
+
+void neo_aa_stream_set_drop_cache(NeoAAStream stream, int dropCache) {
+    stream->dropCache = dropCache;
+}
+
+void neo_aa_stream_set_sparse(NeoAAStream stream, int sparse) {
+    stream->sparse = sparse;
+}
+
+int neo_aa_stream_set_thread_count(NeoAAStream stream, int threadCount) {
+    if (threadCount < 2 || stream->pool || stream->compression == NEO_AA_COMPRESSION_NONE) {
+        /* Raw archives have nothing to decompress */
+        return 0;
+    }
+    if (stream->blockPos != stream->blockLen) {
+        /* Must be set before any blocks are read */
+        return -1;
+    }
+    struct neo_aa_stream_pool *pool = calloc(1, sizeof(struct neo_aa_stream_pool));
+    if (!pool) {
+        return -1;
+    }
+    /* Keep twice as many blocks queued as there are workers */
+    pool->jobCount = threadCount * 2;
+    pool->jobs = calloc(pool->jobCount, sizeof(struct neo_aa_stream_job));
+    pool->threads = calloc(threadCount, sizeof(pthread_t));
+    if (!pool->jobs || !pool->threads) {
+        free(pool->jobs);
+        free(pool->threads);
+        free(pool);
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->jobReady, NULL);
+    pthread_cond_init(&pool->jobDone, NULL);
+    stream->pool = pool;
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&pool->threads[i], NULL, neo_aa_stream_worker, stream)) {
+            break;
+        }
+        pool->threadCount++;
+    }
+    if (!pool->threadCount) {
+        /* Fall back to decompressing on the calling thread */
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->jobReady);
+        pthread_cond_destroy(&pool->jobDone);
+        free(pool->jobs);
+        free(pool->threads);
+        free(pool);
+        stream->pool = NULL;
+    }
+    return 0;
+}
+
+/*
+ * Value size of every subtype plus one, so unknown subtypes are 0.
+ * Strings are prefixed with their uint16 size instead.
+ */
+static const uint8_t neo_aa_stream_subtype_sizes[256] = {
+    ['*'] = 1,
+    ['1'] = 2,
+    ['2'] = 3,
+    ['4'] = 5,
+    ['8'] = 9,
+    ['A'] = 3,
+    ['B'] = 5,
+    ['C'] = 9,
+    ['F'] = 5,
+    ['G'] = 21,
+    ['H'] = 33,
+    ['I'] = 49,
+    ['J'] = 65,
+    ['S'] = 9,
+    ['T'] = 13,
+    ['P'] = NEOAA_STREAM_SUBTYPE_STRING,
+};
+
+/*
+ * Size of the value of a field of subtype at pos, after any uint16
+ * size prefix which is included in prefixSize. -1 if malformed.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_value_size(const uint8_t *header, size_t headerSize, size_t pos, char subtype, size_t *valueSize, size_t *prefixSize) {
+    uint8_t size = neo_aa_stream_subtype_sizes[(uint8_t)subtype];
+    if (size == NEOAA_STREAM_SUBTYPE_STRING) {
+        if (headerSize - pos < 2) {
+            return -1;
+        }
+        *valueSize = neo_aa_stream_le(header + pos, 2);
+        *prefixSize = 2;
+    } else if (size) {
+        *valueSize = size - 1;
+        *prefixSize = 0;
+    } else {
+        /* Unknown subtype, reported once the header is skipped */
+        return -1;
+    }
+    if (headerSize - pos - *prefixSize < *valueSize) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Decodes fields of the current header from where decoding last
+ * stopped, up to and including the first field with key, or up
+ * to the end of the header if key is 0.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_parse_fields(NeoAAStream stream, uint32_t key) {
+    uint8_t *header = stream->header;
+    size_t headerSize = stream->headerSize;
+    while (stream->parsePos < headerSize) {
+        size_t pos = stream->parsePos;
+        if (headerSize - pos < 4) {
+            return -1;
+        }
+        struct neo_aa_stream_field field;
+        field.key = NEOAA_KEY(header + pos);
+        field.subtype = header[pos + 3];
+        field.blobSize = 0;
+        field.blobOffset = 0;
+        pos += 4;
+        size_t valueSize;
+        size_t prefixSize;
+        if (neo_aa_stream_value_size(header, headerSize, pos, field.subtype, &valueSize, &prefixSize)) {
+            return -1;
+        }
+        pos += prefixSize;
+        field.valueOffset = pos;
+        field.valueSize = valueSize;
+        if (field.subtype == 'A' || field.subtype == 'B' || field.subtype == 'C') {
+            field.blobSize = neo_aa_stream_le(header + pos, valueSize);
+            field.blobOffset = stream->parseBlobOffset;
+            stream->parseBlobOffset += field.blobSize;
+        }
+        pos += valueSize;
+        if (stream->fieldCount == stream->fieldCapacity) {
+            int fieldCapacity = stream->fieldCapacity ? stream->fieldCapacity * 2 : 16;
+            struct neo_aa_stream_field *fields = realloc(stream->fields, fieldCapacity * sizeof(struct neo_aa_stream_field));
+            if (!fields) {
+                return -1;
+            }
+            stream->fields = fields;
+            stream->fieldCapacity = fieldCapacity;
+        }
+        int knownField = neo_aa_stream_known_field(field.key);
+        if (knownField != -1 && !stream->knownFields[knownField]) {
+            /* Like the scan, the first field with the key wins */
+            stream->knownFields[knownField] = stream->fieldCount + 1;
+        }
+        stream->fields[stream->fieldCount++] = field;
+        stream->parsePos = pos;
+        if (key && field.key == key) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Finds the total size of the blobs of the current header. Fields
+ * that were not decoded yet are only walked, not stored.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_count_blobs(NeoAAStream stream) {
+    if (stream->blobsCounted) {
+        return 0;
+    }
+    uint8_t *header = stream->header;
+    size_t headerSize = stream->headerSize;
+    size_t pos = stream->parsePos;
+    uint64_t blobSize = stream->parseBlobOffset;
+    while (pos < headerSize) {
+        if (headerSize - pos < 4) {
+            fprintf(stderr,"Malformed header\n");
+            return -1;
+        }
+        char subtype = header[pos + 3];
+        pos += 4;
+        size_t valueSize;
+        size_t prefixSize;
+        if (neo_aa_stream_value_size(header, headerSize, pos, subtype, &valueSize, &prefixSize)) {
+            fprintf(stderr,"Malformed header\n");
+            return -1;
+        }
+        pos += prefixSize;
+        if (subtype == 'A' || subtype == 'B' || subtype == 'C') {
+            blobSize += neo_aa_stream_le(header + pos, valueSize);
+        }
+        pos += valueSize;
+    }
+    stream->blobRemaining = blobSize;
+    stream->blobsCounted = 1;
+    return 0;
+}
+
+int neo_aa_stream_skip_blobs(NeoAAStream stream) {
+    if (neo_aa_stream_count_blobs(stream)) {
+        return -1;
+    }
+    if (!stream->blobRemaining) {
+        return 0;
+    }
+    if (neo_aa_stream_skip(stream, stream->blobRemaining)) {
+        return -1;
+    }
+    stream->blobConsumed += stream->blobRemaining;
+    stream->blobRemaining = 0;
+    stream->blobLeft = 0;
+    return 0;
+}
+
+int neo_aa_stream_seek_blob(NeoAAStream stream, int index) {
+    if (index < 0 || index >= stream->fieldCount) {
+        return -1;
+    }
+    struct neo_aa_stream_field *field = &stream->fields[index];
+    if (field->subtype != 'A' && field->subtype != 'B' && field->subtype != 'C') {
+        return -1;
+    }
+    if (field->blobOffset < stream->blobConsumed) {
+        /* Blobs can only be read in order */
+        return -1;
+    }
+    if (neo_aa_stream_count_blobs(stream)) {
+        return -1;
+    }
+    uint64_t gap = field->blobOffset - stream->blobConsumed;
+    if (gap) {
+        if (neo_aa_stream_skip(stream, gap)) {
+            return -1;
+        }
+        stream->blobConsumed += gap;
+        stream->blobRemaining -= gap;
+    }
+    stream->blobLeft = field->blobSize;
+    stream->blobIndex = index;
+    return 0;
+}
+
+ssize_t neo_aa_stream_read_field_blob(NeoAAStream stream, int index, void *buffer, size_t size) {
+    if (stream->blobIndex != index && neo_aa_stream_seek_blob(stream, index)) {
+        return -1;
+    }
+    return neo_aa_stream_read_blob(stream, buffer, size);
+}
+
+ssize_t neo_aa_stream_read_blob(NeoAAStream stream, void *buffer, size_t size) {
+    if (size > stream->blobLeft) {
+        size = stream->blobLeft;
+    }
+    if (!size) {
+        return 0;
+    }
+    ssize_t bytesRead = neo_aa_stream_read(stream, buffer, size);
+    if (bytesRead != (ssize_t)size) {
+        /* Archive ended in the middle of a blob */
+        return -1;
+    }
+    stream->blobConsumed += size;
+    stream->blobRemaining -= size;
+    stream->blobLeft -= size;
+    return size;
+}
+
+const void *neo_aa_stream_map_blob_range(NeoAAStream stream, int index, uint64_t *offset, uint64_t *size) {
+    if (!stream->map || neo_aa_stream_seek_blob(stream, index)) {
+        return NULL;
+    }
+    uint64_t blobSize = stream->blobLeft;
+    if (blobSize > stream->fileSize - stream->position) {
+        /* Archive ended in the middle of a blob */
+        return NULL;
+    }
+    const uint8_t *data = stream->map + stream->position;
+    stream->position += blobSize;
+    stream->blobConsumed += blobSize;
+    stream->blobRemaining -= blobSize;
+    stream->blobLeft = 0;
+    /* Mapped archives are raw, so the plain stream is the file */
+    *offset = data - stream->map;
+    *size = blobSize;
+    return data;
+}
+
+int neo_aa_stream_write_blob_to_fd(NeoAAStream stream, int index, int fd) {
+    if (stream->map) {
+        uint64_t offset;
+        uint64_t size;
+        const uint8_t *data = neo_aa_stream_map_blob_range(stream, index, &offset, &size);
+        if (!data) {
+            return -1;
+        }
+        if (stream->sparse) {
+            return neo_aa_sparse_write(stream->fd, offset, data, size, fd, 0);
+        }
+        return neo_aa_copy_range(stream->fd, offset, data, size, fd);
+    }
+    if (neo_aa_stream_seek_blob(stream, index)) {
+        return -1;
+    }
+    if (!stream->chunk) {
+        stream->chunk = malloc(NEOAA_STREAM_CHUNK_SIZE);
+        if (!stream->chunk) {
+            return -1;
+        }
+    }
+    uint64_t written = 0;
+    ssize_t bytesRead;
+    while ((bytesRead = neo_aa_stream_read_blob(stream, stream->chunk, NEOAA_STREAM_CHUNK_SIZE)) > 0) {
+        if (stream->sparse) {
+            if (neo_aa_sparse_write(-1, 0, stream->chunk, bytesRead, fd, written)) {
+                return -1;
+            }
+            written += bytesRead;
+            continue;
+        }
+        uint8_t *chunk = stream->chunk;
+        while (bytesRead) {
+            ssize_t bytesWritten = write(fd, chunk, bytesRead);
+            if (bytesWritten < 0) {
+                return -1;
+            }
+            chunk += bytesWritten;
+            bytesRead -= bytesWritten;
+        }
+    }
+    return bytesRead < 0 ? -1 : 0;
+}
+
+/*
+ * Asks for the file ahead of the stream to be read in and, with
+ * drop cache set, drops the file behind it from the page cache.
+ */
+__attribute__((visibility ("hidden"))) static void neo_aa_stream_advise(NeoAAStream stream) {
+    if (!stream->seekable) {
+        return;
+    }
+    uint64_t position = stream->position;
+    if (stream->adviseOffset < stream->fileSize && position + NEOAA_STREAM_ADVISE_WINDOW / 2 >= stream->adviseOffset) {
+        uint64_t start = position > stream->adviseOffset ? position : stream->adviseOffset;
+        neo_aa_advise_willneed(stream->fd, start, NEOAA_STREAM_ADVISE_WINDOW);
+        stream->adviseOffset = start + NEOAA_STREAM_ADVISE_WINDOW;
+    }
+    if (stream->dropCache && position >= stream->dropOffset + NEOAA_STREAM_ADVISE_WINDOW) {
+        neo_aa_advise_dontneed(stream->fd, stream->map, stream->dropOffset, position - stream->dropOffset);
+        stream->dropOffset = position;
+    }
+}
+
+int neo_aa_stream_next_header(NeoAAStream stream) {
+    if (neo_aa_stream_skip_blobs(stream)) {
+        return -1;
+    }
+    neo_aa_stream_advise(stream);
+    stream->headerOffset = neo_aa_stream_get_plain_position(stream);
+    ssize_t bytesRead = neo_aa_stream_read(stream, stream->header, 6);
+    if (bytesRead == 0) {
+        return 0;
+    }
+    if (bytesRead != 6) {
+        return -1;
+    }
+    if (memcmp(stream->header, "AA01", 4) != 0 && memcmp(stream->header, "YAA1", 4) != 0) {
+        fprintf(stderr,"Invalid header magic\n");
+        return -1;
+    }
+    size_t headerSize = neo_aa_stream_le(stream->header + 4, 2);
+    if (headerSize < 6) {
+        return -1;
+    }
+    if (neo_aa_stream_read(stream, stream->header + 6, headerSize - 6) != (ssize_t)(headerSize - 6)) {
+        return -1;
+    }
+    stream->headerSize = headerSize;
+    /* Fields are decoded when they are first looked up */
+    stream->fieldCount = 0;
+    memset(stream->knownFields, 0, sizeof(stream->knownFields));
+    stream->parsePos = 6;
+    stream->parseBlobOffset = 0;
+    stream->blobsCounted = 0;
+    stream->blobRemaining = 0;
+    stream->blobConsumed = 0;
+    stream->blobLeft = 0;
+    stream->blobIndex = -1;
+    return 1;
+}
+
+uint64_t neo_aa_stream_get_header_offset(NeoAAStream stream) {
+    return stream->headerOffset;
+}
+
+size_t neo_aa_stream_get_header_size(NeoAAStream stream) {
+    return stream->headerSize;
+}
+
+int neo_aa_stream_seek_header(NeoAAStream stream, uint64_t blockFileOffset, uint64_t blockPlainOffset, uint64_t headerOffset) {
+    if (stream->pool) {
+        /* Blocks queued on the pool can not be discarded */
+        return -1;
+    }
+    /* Nothing of the current entry is left to skip */
+    stream->blobsCounted = 1;
+    stream->blobRemaining = 0;
+    stream->blobConsumed = 0;
+    stream->blobLeft = 0;
+    stream->blobIndex = -1;
+    /* Seeked streams are not read ahead, and only what is read after the seek is dropped */
+    stream->adviseOffset = UINT64_MAX;
+    stream->dropOffset = stream->compression == NEO_AA_COMPRESSION_NONE ? headerOffset : blockFileOffset;
+    if (stream->compression == NEO_AA_COMPRESSION_NONE) {
+        if (headerOffset > stream->fileSize || (!stream->map && lseek(stream->fd, headerOffset, SEEK_SET) == -1)) {
+            return -1;
+        }
+        stream->position = headerOffset;
+        stream->inputPos = 0;
+        stream->inputLen = 0;
+        return 0;
+    }
+    if (headerOffset < blockPlainOffset) {
+        return -1;
+    }
+    if (stream->blockLen && stream->blockPlainStart == blockPlainOffset && headerOffset - blockPlainOffset <= stream->blockLen) {
+        /* Header is in the block we already decompressed */
+        stream->blockPos = headerOffset - blockPlainOffset;
+        stream->plainPosition = headerOffset;
+        return 0;
+    }
+    if (blockFileOffset > stream->fileSize || lseek(stream->fd, blockFileOffset, SEEK_SET) == -1) {
+        return -1;
+    }
+    stream->position = blockFileOffset;
+    stream->inputPos = 0;
+    stream->inputLen = 0;
+    stream->blockPos = 0;
+    stream->blockLen = 0;
+    stream->plainPosition = blockPlainOffset;
+    return neo_aa_stream_skip(stream, headerOffset - blockPlainOffset);
+}
+
+/*
+ * Bit i of the result is set if byte i of bytes is 0, for the
+ * first 32 bytes.
+ */
+__attribute__((visibility ("hidden"))) static uint32_t neo_aa_stream_zero_mask(const uint8_t *bytes) {
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    uint32_t low = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)bytes), zero));
+    uint32_t high = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(bytes + 16)), zero));
+    return low | (high << 16);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t laneBits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vld1q_u8(laneBits);
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i += 16) {
+        uint8x16_t zero = vandq_u8(vceqzq_u8(vld1q_u8(bytes + i)), bits);
+        mask |= ((uint32_t)vaddv_u8(vget_low_u8(zero)) | ((uint32_t)vaddv_u8(vget_high_u8(zero)) << 8)) << i;
+    }
+    return mask;
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i++) {
+        mask |= (uint32_t)(bytes[i] == 0) << i;
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Bit i of the result is set if an AA01 or YAA1 magic may start at
+ * byte i of bytes, for the first 16 bytes. 19 bytes are read.
+ */
+__attribute__((visibility ("hidden"))) static uint32_t neo_aa_stream_magic_mask(const uint8_t *bytes) {
+#if defined(__SSE2__)
+    __m128i first = _mm_loadu_si128((const __m128i *)bytes);
+    __m128i last = _mm_loadu_si128((const __m128i *)(bytes + 3));
+    __m128i start = _mm_or_si128(_mm_cmpeq_epi8(first, _mm_set1_epi8('A')), _mm_cmpeq_epi8(first, _mm_set1_epi8('Y')));
+    return _mm_movemask_epi8(_mm_and_si128(start, _mm_cmpeq_epi8(last, _mm_set1_epi8('1'))));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t laneBits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t first = vld1q_u8(bytes);
+    uint8x16_t last = vld1q_u8(bytes + 3);
+    uint8x16_t start = vorrq_u8(vceqq_u8(first, vdupq_n_u8('A')), vceqq_u8(first, vdupq_n_u8('Y')));
+    uint8x16_t hits = vandq_u8(vandq_u8(start, vceqq_u8(last, vdupq_n_u8('1'))), vld1q_u8(laneBits));
+    return (uint32_t)vaddv_u8(vget_low_u8(hits)) | ((uint32_t)vaddv_u8(vget_high_u8(hits)) << 8);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 16; i++) {
+        mask |= (uint32_t)((bytes[i] == 'A' || bytes[i] == 'Y') && bytes[i + 3] == '1') << i;
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Checks whether bytes, of which size are available, start with
+ * something that looks like an entry header. Headers cut short by
+ * size are checked as far as they go. entrySize is set to the size
+ * of the header and its blobs if all of the header is available.
+ */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_check_header(const uint8_t *bytes, size_t size, uint64_t *entrySize) {
+    if (size < 6 || (memcmp(bytes, "AA01", 4) != 0 && memcmp(bytes, "YAA1", 4) != 0)) {
+        return 0;
+    }
+    size_t headerSize = neo_aa_stream_le(bytes + 4, 2);
+    if (headerSize < 6) {
+        return 0;
+    }
+    size_t available = headerSize < size ? headerSize : size;
+    uint64_t blobSize = 0;
+    size_t pos = 6;
+    while (pos < headerSize) {
+        if (pos > available || available - pos < 4) {
+            break;
+        }
+        char subtype = bytes[pos + 3];
+        uint8_t valueSize = neo_aa_stream_subtype_sizes[(uint8_t)subtype];
+        if (!valueSize) {
+            return 0;
+        }
+        pos += 4;
+        if (valueSize == NEOAA_STREAM_SUBTYPE_STRING) {
+            if (available - pos < 2) {
+                break;
+            }
+            pos += 2 + neo_aa_stream_le(bytes + pos, 2);
+        } else {
+            /* valueSize is not 0 here, unknown subtypes returned above */
+            size_t fieldSize = (size_t)valueSize - 1;
+            if (available - pos >= fieldSize && (subtype == 'A' || subtype == 'B' || subtype == 'C')) {
+                blobSize += neo_aa_stream_le(bytes + pos, fieldSize);
+            }
+            pos += fieldSize;
+        }
+        if (pos > headerSize) {
+            return 0;
+        }
+    }
+    *entrySize = available == headerSize ? headerSize + blobSize : 0;
+    return 1;
+}
+
+/*
+ * Finds the first header that looks intact at or after pos in data.
+ * If complete is set, all of the header and its blobs must be in
+ * data. Returns size if there is none.
+ */
+__attribute__((visibility ("hidden"))) static size_t neo_aa_stream_find_header(const uint8_t *data, size_t size, size_t pos, int complete) {
+    while (pos < size) {
+        uint32_t candidates;
+        size_t step;
+        if (size - pos >= 19) {
+            candidates = neo_aa_stream_magic_mask(data + pos);
+            step = 16;
+        } else {
+            candidates = (data[pos] == 'A' || data[pos] == 'Y') ? 1 : 0;
+            step = 1;
+        }
+        while (candidates) {
+            size_t candidate = pos + __builtin_ctz(candidates);
+            uint64_t entrySize;
+            if (neo_aa_stream_check_header(data + candidate, size - candidate, &entrySize) && (!complete || (entrySize && entrySize <= size - candidate))) {
+                return candidate;
+            }
+            candidates &= candidates - 1;
+        }
+        pos += step;
+    }
+    return size;
+}
+
+/* Checks whether the 16 bytes at offset look like a block header */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_check_block_header(NeoAAStream stream, uint64_t offset) {
+    const uint8_t *bytes = stream->scanMap + offset;
+    uint64_t uncompressedSize = neo_aa_stream_be64(bytes);
+    uint64_t compressedSize = neo_aa_stream_be64(bytes + 8);
+    if (!uncompressedSize || uncompressedSize > stream->blockSize || !compressedSize || compressedSize > uncompressedSize) {
+        return 0;
+    }
+    if (compressedSize > stream->fileSize - offset - 16) {
+        return 0;
+    }
+    if (compressedSize == uncompressedSize) {
+        return 1;
+    }
+    /* Reject payloads that can not be of the compression of the archive */
+    const uint8_t *payload = bytes + 16;
+    if (stream->compression == NEO_AA_COMPRESSION_LZFSE) {
+        return compressedSize >= 4 && memcmp(payload, "bvx", 3) == 0;
+    } else if (stream->compression == NEO_AA_COMPRESSION_LZBITMAP) {
+        return compressedSize >= 4 && memcmp(payload, "ZBM", 3) == 0;
+    }
+    return 1;
+}
+
+/*
+ * Finds the first block header that looks intact at or after offset
+ * in a compressed archive. The sizes in a block header are at most
+ * blockSize, so their top bytes are 0, which rules out almost every
+ * offset of compressed data without looking at it any further.
+ */
+__attribute__((visibility ("hidden"))) static uint64_t neo_aa_stream_find_block(NeoAAStream stream, uint64_t offset) {
+    int zeroBytes = stream->blockSize ? __builtin_clzll(stream->blockSize) / 8 : 8;
+    uint64_t fileSize = stream->fileSize;
+    if (fileSize < 16) {
+        return fileSize;
+    }
+    while (offset <= fileSize - 16) {
+        uint32_t candidates;
+        if (fileSize - offset >= 32) {
+            uint32_t zeros = neo_aa_stream_zero_mask(stream->scanMap + offset);
+            candidates = 0xFFFF;
+            for (int i = 0; i < zeroBytes; i++) {
+                candidates &= (zeros >> i) & (zeros >> (8 + i));
+            }
+        } else {
+            candidates = 1;
+        }
+        while (candidates) {
+            uint64_t candidate = offset + __builtin_ctz(candidates);
+            if (candidate <= fileSize - 16 && neo_aa_stream_check_block_header(stream, candidate)) {
+                return candidate;
+            }
+            candidates &= candidates - 1;
+        }
+        offset += fileSize - offset >= 32 ? 16 : 1;
+    }
+    return fileSize;
+}
+
+/* Loads the first block that can be read after the damaged one */
+__attribute__((visibility ("hidden"))) static int neo_aa_stream_resync_block(NeoAAStream stream) {
+    if (!stream->scanMap) {
+        void *scanMap = mmap(NULL, stream->fileSize, PROT_READ, MAP_PRIVATE, stream->fd, 0);
+        if (scanMap == MAP_FAILED) {
+            return -1;
+        }
+        stream->scanMap = scanMap;
+    }
+    uint64_t offset = stream->blockFileOffset + 1;
+    while ((offset = neo_aa_stream_find_block(stream, offset)) < stream->fileSize) {
+        if (lseek(stream->fd, offset, SEEK_SET) == -1) {
+            return -1;
+        }
+        stream->position = offset;
+        stream->inputPos = 0;
+        stream->inputLen = 0;
+        stream->blockPos = 0;
+        stream->blockLen = 0;
+        stream->blockDamaged = 0;
+        uint64_t skipped;
+        int status = neo_aa_stream_next_block(stream, 0, &skipped);
+        if (status == 1) {
+            return 1;
+        }
+        if (!stream->blockDamaged) {
+            return -1;
+        }
+        offset++;
+    }
+    return 0;
+}
+
+int neo_aa_stream_resync(NeoAAStream stream) {
+    if (stream->pool || !stream->seekable) {
+        return -1;
+    }
+    /* Nothing of the damaged entry is left to skip */
+    stream->blobsCounted = 1;
+    stream->blobRemaining = 0;
+    stream->blobConsumed = 0;
+    stream->blobLeft = 0;
+    stream->blobIndex = -1;
+    if (stream->compression == NEO_AA_COMPRESSION_NONE) {
+        if (!stream->map) {
+            return -1;
+        }
+        uint64_t offset = neo_aa_stream_find_header(stream->map, stream->fileSize, stream->headerOffset + 1, 1);
+        stream->position = offset;
+        return offset < stream->fileSize ? 1 : 0;
+    }
+    /* Search the current block from past the damaged header */
+    size_t scanPos = stream->blockPos;
+    if (stream->headerOffset >= stream->blockPlainStart && stream->headerOffset - stream->blockPlainStart < stream->blockLen) {
+        scanPos = stream->headerOffset - stream->blockPlainStart + 1;
+    }
+    while (1) {
+        if (stream->blockDamaged) {
+            int status = neo_aa_stream_resync_block(stream);
+            if (status != 1) {
+                return status;
+            }
+            scanPos = 0;
+        }
+        size_t headerPos = neo_aa_stream_find_header(stream->blockData, stream->blockLen, scanPos, 0);
+        if (headerPos < stream->blockLen) {
+            stream->blockPos = headerPos;
+            stream->plainPosition = stream->blockPlainStart + headerPos;
+            return 1;
+        }
+        /* Move on to the next block */
+        stream->plainPosition = stream->blockPlainStart + stream->blockLen;
+        stream->blockPos = stream->blockLen;
+        uint64_t skipped;
+        int status = neo_aa_stream_next_block(stream, 0, &skipped);
+        if (status == 0) {
+            return 0;
+        }
+        if (status == -1 && !stream->blockDamaged) {
+            return -1;
+        }
+        scanPos = 0;
+    }
+}
+
+int neo_aa_stream_get_known_field_index(NeoAAStream stream, NeoAAStreamField field) {
+    if ((unsigned)field >= NEOAA_STREAM_FIELD_COUNT) {
+        return -1;
+    }
+    if (!stream->knownFields[field] && neo_aa_stream_parse_fields(stream, neo_aa_stream_known_keys[field])) {
+        return -1;
+    }
+    return stream->knownFields[field] - 1;
+}
+
+char neo_aa_stream_get_field_subtype(NeoAAStream stream, int index) {
+    if (index < 0 || index >= stream->fieldCount) {
+        return 0;
+    }
+    return stream->fields[index].subtype;
+}
+
+const char *neo_aa_stream_get_field_string_view(NeoAAStream stream, int index, size_t *length) {
+    if (index < 0 || index >= stream->fieldCount || stream->fields[index].subtype != 'P') {
+        return NULL;
+    }
+    struct neo_aa_stream_field *field = &stream->fields[index];
+    *length = field->valueSize;
+    return (const char *)stream->header + field->valueOffset;
+}
+
+uint64_t neo_aa_stream_get_field_uint(NeoAAStream stream, int index) {
+    if (index < 0 || index >= stream->fieldCount) {
+        return 0;
+    }
+    struct neo_aa_stream_field *field = &stream->fields[index];
+    if (field->subtype < '1' || field->subtype > '8') {
+        return 0;
+    }
+    return neo_aa_stream_le(stream->header + field->valueOffset, field->valueSize);
+}
+
+uint64_t neo_aa_stream_get_field_blob_size(NeoAAStream stream, int index) {
+    if (index < 0 || index >= stream->fieldCount) {
+        return 0;
+    }
+    return stream->fields[index].blobSize;
+}
+
+int neo_aa_stream_get_field_timespec(NeoAAStream stream, int index, struct timespec *ts) {
+    if (index < 0 || index >= stream->fieldCount) {
+        return -1;
+    }
+    struct neo_aa_stream_field *field = &stream->fields[index];
+    uint8_t *value = stream->header + field->valueOffset;
+    if (field->subtype == 'S') {
+        ts->tv_sec = neo_aa_stream_le(value, 8);
+        ts->tv_nsec = 0;
+    } else if (field->subtype == 'T') {
+        ts->tv_sec = neo_aa_stream_le(value, 8);
+        ts->tv_nsec = neo_aa_stream_le(value + 8, 4);
+    } else {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ *  stream.h
+ *  neoaa
+ */
+
+#ifndef neoaa_stream_h
+#define neoaa_stream_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * Field keys are the 3 character key of the field,
+ * with the subtype character not included.
+ */
+#define NEOAA_KEY(str) ((uint32_t)(uint8_t)(str)[0] | ((uint32_t)(uint8_t)(str)[1] << 8) | ((uint32_t)(uint8_t)(str)[2] << 16))
+
+/*
+ * Field keys every header is indexed by when it is parsed,
+ * looking one of these up does not scan the header. Fields are
+ * only looked up by these keys.
+ */
+typedef enum {
+    NEOAA_STREAM_FIELD_TYP,
+    NEOAA_STREAM_FIELD_PAT,
+    NEOAA_STREAM_FIELD_LNK,
+    NEOAA_STREAM_FIELD_DEV,
+    NEOAA_STREAM_FIELD_INO,
+    NEOAA_STREAM_FIELD_NLK,
+    NEOAA_STREAM_FIELD_UID,
+    NEOAA_STREAM_FIELD_GID,
+    NEOAA_STREAM_FIELD_MOD,
+    NEOAA_STREAM_FIELD_FLG,
+    NEOAA_STREAM_FIELD_MTM,
+    NEOAA_STREAM_FIELD_CTM,
+    NEOAA_STREAM_FIELD_BTM,
+    NEOAA_STREAM_FIELD_DAT,
+    NEOAA_STREAM_FIELD_SIZ,
+    NEOAA_STREAM_FIELD_XAT,
+    NEOAA_STREAM_FIELD_ACL,
+    NEOAA_STREAM_FIELD_CKS,
+    NEOAA_STREAM_FIELD_SH1,
+    NEOAA_STREAM_FIELD_SH2,
+    NEOAA_STREAM_FIELD_SH3,
+    NEOAA_STREAM_FIELD_SH5,
+    NEOAA_STREAM_FIELD_IDX,
+    NEOAA_STREAM_FIELD_IDZ,
+    NEOAA_STREAM_FIELD_HLC,
+    NEOAA_STREAM_FIELD_CLC,
+    NEOAA_STREAM_FIELD_AFT,
+    NEOAA_STREAM_FIELD_AFR,
+    NEOAA_STREAM_FIELD_YEC,
+    NEOAA_STREAM_FIELD_LBL,
+    NEOAA_STREAM_FIELD_COUNT,
+} NeoAAStreamField;
+
+typedef struct neo_aa_stream_impl *NeoAAStream;
+
+/*
+ * NeoAAStream walks an archive one AA01 record at a time
+ * without ever holding more than a single header (and a
+ * single compressed block for compressed archives) in
+ * memory, unlike neo_aa_archive_generic_from_path().
+ */
+NeoAAStream neo_aa_stream_open(const char *path);
+
+/*
+ * Reads the archive from fd, which may be a pipe. The stream does
+ * not close fd. Seeking is only supported for regular files.
+ */
+NeoAAStream neo_aa_stream_open_fd(int fd);
+
+/*
+ * Opens an archive that may be damaged. Files that are not
+ * compressed archives are read as raw archives even if they do
+ * not start with a header, see neo_aa_stream_resync().
+ */
+NeoAAStream neo_aa_stream_open_damaged(const char *path);
+void neo_aa_stream_close(NeoAAStream stream);
+
+/*
+ * Reads the header of the next entry, skipping over any
+ * blob data of the current entry that was not consumed.
+ * Returns 1 if a header was read, 0 at the end of the
+ * archive and -1 on error.
+ */
+int neo_aa_stream_next_header(NeoAAStream stream);
+
+/* Offset and size of the current header in the plain stream */
+uint64_t neo_aa_stream_get_header_offset(NeoAAStream stream);
+size_t neo_aa_stream_get_header_size(NeoAAStream stream);
+
+/*
+ * Moves the stream so the next neo_aa_stream_next_header() reads
+ * the header at headerOffset in the plain stream. For compressed
+ * archives the header must be in the block whose block header
+ * is at blockFileOffset in the file, starting at blockPlainOffset
+ * in the plain stream. Not supported with worker threads.
+ */
+int neo_aa_stream_seek_header(NeoAAStream stream, uint64_t blockFileOffset, uint64_t blockPlainOffset, uint64_t headerOffset);
+
+/*
+ * After neo_aa_stream_next_header() failed, moves the stream to the
+ * next header that looks intact, so the next call reads it. Damaged
+ * blocks of compressed archives are skipped by searching the file
+ * for the next block header. Returns 1 if a header was found, 0 at
+ * the end of the archive and -1 on error. Only supported for
+ * regular files without worker threads.
+ */
+int neo_aa_stream_resync(NeoAAStream stream);
+
+/* Skips the blob data of the current entry. */
+int neo_aa_stream_skip_blobs(NeoAAStream stream);
+
+/*
+ * Positions the stream at the start of the blob of the field
+ * at index, after which neo_aa_stream_read_blob() reads from
+ * it. Blobs of an entry can only be read in order.
+ */
+int neo_aa_stream_seek_blob(NeoAAStream stream, int index);
+ssize_t neo_aa_stream_read_blob(NeoAAStream stream, void *buffer, size_t size);
+
+/*
+ * Reads the blob of the field at index in chunks, seeking to it
+ * on the first call. Returns 0 once all of it has been read.
+ */
+ssize_t neo_aa_stream_read_field_blob(NeoAAStream stream, int index, void *buffer, size_t size);
+
+/*
+ * Returns the blob of the field at index in place and moves past
+ * it, without copying, and its offset in the archive file. Only
+ * raw archives are mapped, NULL if the stream is not.
+ */
+const void *neo_aa_stream_map_blob_range(NeoAAStream stream, int index, uint64_t *offset, uint64_t *size);
+
+/*
+ * Writes the blob of the field at index to fd in chunks. Blobs of
+ * mapped archives are copied by the kernel where it can. If the
+ * stream is sparse, zero blocks are left as holes, so fd must be a
+ * new or truncated file.
+ */
+int neo_aa_stream_write_blob_to_fd(NeoAAStream stream, int index, int fd);
+
+/* File descriptor the archive is read from */
+int neo_aa_stream_get_fd(NeoAAStream stream);
+int neo_aa_stream_get_compression(NeoAAStream stream);
+
+/*
+ * Decompresses blocks of compressed archives on threadCount
+ * worker threads. Must be called before reading any headers.
+ */
+int neo_aa_stream_set_thread_count(NeoAAStream stream, int threadCount);
+
+/*
+ * Drops the part of the archive the stream is done with from the
+ * page cache as it reads on, so reading a large archive does not
+ * evict everything else that is cached.
+ */
+void neo_aa_stream_set_drop_cache(NeoAAStream stream, int dropCache);
+
+/*
+ * Leaves the zero blocks of blobs written to files as holes rather
+ * than writing them, at the cost of scanning every blob written.
+ */
+void neo_aa_stream_set_sparse(NeoAAStream stream, int sparse);
+
+/*
+ * Field accessors for the current header. Field indexes are -1
+ * if the header does not have the field.
+ */
+int neo_aa_stream_get_known_field_index(NeoAAStream stream, NeoAAStreamField field);
+char neo_aa_stream_get_field_subtype(NeoAAStream stream, int index);
+
+/*
+ * Returns a string field in place, without copying it. The string
+ * is not NUL terminated and is only valid until the next header is
+ * read.
+ */
+const char *neo_aa_stream_get_field_string_view(NeoAAStream stream, int index, size_t *length);
+uint64_t neo_aa_stream_get_field_uint(NeoAAStream stream, int index);
+uint64_t neo_aa_stream_get_field_blob_size(NeoAAStream stream, int index);
+int neo_aa_stream_get_field_timespec(NeoAAStream stream, int index, struct timespec *ts);
+
+#endif /* neoaa_stream_h */
@@ -0,0 +1,311 @@
+/*
+ *  uring.c
+ *  neoaa
+ */
+
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#endif
+
+/* Opening into direct descriptors came with Linux 5.15, skipping completions with 5.17 */
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(IORING_FEAT_CQE_SKIP)
+#define NEOAA_URING_SUPPORTED 1
+#else
+#define NEOAA_URING_SUPPORTED 0
+#endif
+
+#if NEOAA_URING_SUPPORTED
+
+struct neo_aa_uring_impl {
+    int fd;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    /* Tail of the queued entries, published to sqTail on submit */
+    unsigned sqQueuedTail;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+};
+
+NeoAAUring neo_aa_uring_create(unsigned entries, unsigned fileCount) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!(params.features & IORING_FEAT_CQE_SKIP)) {
+        close(fd);
+        return NULL;
+    }
+    NeoAAUring ring = calloc(1, sizeof(struct neo_aa_uring_impl));
+    if (!ring) {
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize) {
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        ring->sqRing = NULL;
+        neo_aa_uring_destroy(ring);
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) {
+            ring->cqRing = NULL;
+            neo_aa_uring_destroy(ring);
+            return NULL;
+        }
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        neo_aa_uring_destroy(ring);
+        return NULL;
+    }
+    uint8_t *sq = ring->sqRing;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqEntries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    ring->sqQueuedTail = *ring->sqTail;
+    uint8_t *cq = ring->cqRing;
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    /* Empty slots for the files to be opened into */
+    int *files = malloc(fileCount * sizeof(int));
+    if (!files) {
+        neo_aa_uring_destroy(ring);
+        return NULL;
+    }
+    for (unsigned i = 0; i < fileCount; i++) {
+        files[i] = -1;
+    }
+    int registered = (int)syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, files, fileCount);
+    free(files);
+    if (registered < 0) {
+        neo_aa_uring_destroy(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void neo_aa_uring_destroy(NeoAAUring ring) {
+    if (!ring) {
+        return;
+    }
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->cqRing && ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing) {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    /* Closing the ring closes every file still open in it */
+    close(ring->fd);
+    free(ring);
+}
+
+unsigned neo_aa_uring_get_space(NeoAAUring ring) {
+    return ring->sqEntries - (ring->sqQueuedTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE));
+}
+
+__attribute__((visibility ("hidden"))) static struct io_uring_sqe *neo_aa_uring_queue(NeoAAUring ring, uint8_t opcode, uint64_t userData, int queueFlags) {
+    unsigned index = ring->sqQueuedTail & ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = userData;
+    if (queueFlags & NEOAA_URING_LINK) {
+        sqe->flags |= IOSQE_IO_LINK;
+    }
+    if (queueFlags & NEOAA_URING_SKIP_SUCCESS) {
+        sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+    }
+    ring->sqArray[index] = index;
+    ring->sqQueuedTail++;
+    return sqe;
+}
+
+void neo_aa_uring_queue_openat(NeoAAUring ring, int dirFd, const char *name, int flags, mode_t mode, unsigned fileIndex, uint64_t userData, int queueFlags) {
+    struct io_uring_sqe *sqe = neo_aa_uring_queue(ring, IORING_OP_OPENAT, userData, queueFlags);
+    sqe->fd = dirFd;
+    sqe->addr = (uint64_t)(uintptr_t)name;
+    sqe->len = mode;
+    sqe->open_flags = flags;
+    /* Direct descriptor indices are offset by one, 0 is a normal fd */
+    sqe->file_index = fileIndex + 1;
+}
+
+void neo_aa_uring_queue_write(NeoAAUring ring, unsigned fileIndex, const void *data, uint32_t size, uint64_t offset, uint64_t userData, int queueFlags) {
+    struct io_uring_sqe *sqe = neo_aa_uring_queue(ring, IORING_OP_WRITE, userData, queueFlags);
+    sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->fd = (int)fileIndex;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = size;
+    sqe->off = offset;
+}
+
+void neo_aa_uring_queue_fdatasync(NeoAAUring ring, unsigned fileIndex, uint64_t userData, int queueFlags) {
+    struct io_uring_sqe *sqe = neo_aa_uring_queue(ring, IORING_OP_FSYNC, userData, queueFlags);
+    sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->fd = (int)fileIndex;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+}
+
+void neo_aa_uring_queue_fadvise(NeoAAUring ring, unsigned fileIndex, uint64_t offset, uint32_t length, int advice, uint64_t userData, int queueFlags) {
+    struct io_uring_sqe *sqe = neo_aa_uring_queue(ring, IORING_OP_FADVISE, userData, queueFlags);
+    sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->fd = (int)fileIndex;
+    sqe->off = offset;
+    sqe->len = length;
+    sqe->fadvise_advice = (uint32_t)advice;
+}
+
+void neo_aa_uring_queue_close(NeoAAUring ring, unsigned fileIndex, uint64_t userData, int queueFlags) {
+    struct io_uring_sqe *sqe = neo_aa_uring_queue(ring, IORING_OP_CLOSE, userData, queueFlags);
+    sqe->file_index = fileIndex + 1;
+}
+
+int neo_aa_uring_submit(NeoAAUring ring, unsigned waitCount) {
+    __atomic_store_n(ring->sqTail, ring->sqQueuedTail, __ATOMIC_RELEASE);
+    while (1) {
+        unsigned toSubmit = ring->sqQueuedTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if (!toSubmit && !waitCount) {
+            return 0;
+        }
+        int result = (int)syscall(__NR_io_uring_enter, ring->fd, toSubmit, waitCount, waitCount ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        /* Entries the kernel did not take yet go with the next call */
+        return 0;
+    }
+}
+
+int neo_aa_uring_next_completion(NeoAAUring ring, uint64_t *userData, int32_t *result) {
+    unsigned head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+    *userData = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#else
+
+NeoAAUring neo_aa_uring_create(unsigned entries, unsigned fileCount) {
+    (void)entries;
+    (void)fileCount;
+    return NULL;
+}
+
+void neo_aa_uring_destroy(NeoAAUring ring) {
+    (void)ring;
+}
+
+/* Never called without a ring */
+unsigned neo_aa_uring_get_space(NeoAAUring ring) {
+    (void)ring;
+    return 0;
+}
+
+void neo_aa_uring_queue_openat(NeoAAUring ring, int dirFd, const char *name, int flags, mode_t mode, unsigned fileIndex, uint64_t userData, int queueFlags) {
+    (void)ring;
+    (void)dirFd;
+    (void)name;
+    (void)flags;
+    (void)mode;
+    (void)fileIndex;
+    (void)userData;
+    (void)queueFlags;
+}
+
+void neo_aa_uring_queue_write(NeoAAUring ring, unsigned fileIndex, const void *data, uint32_t size, uint64_t offset, uint64_t userData, int queueFlags) {
+    (void)ring;
+    (void)fileIndex;
+    (void)data;
+    (void)size;
+    (void)offset;
+    (void)userData;
+    (void)queueFlags;
+}
+
+void neo_aa_uring_queue_fdatasync(NeoAAUring ring, unsigned fileIndex, uint64_t userData, int queueFlags) {
+    (void)ring;
+    (void)fileIndex;
+    (void)userData;
+    (void)queueFlags;
+}
+
+void neo_aa_uring_queue_fadvise(NeoAAUring ring, unsigned fileIndex, uint64_t offset, uint32_t length, int advice, uint64_t userData, int queueFlags) {
+    (void)ring;
+    (void)fileIndex;
+    (void)offset;
+    (void)length;
+    (void)advice;
+    (void)userData;
+    (void)queueFlags;
+}
+
+void neo_aa_uring_queue_close(NeoAAUring ring, unsigned fileIndex, uint64_t userData, int queueFlags) {
+    (void)ring;
+    (void)fileIndex;
+    (void)userData;
+    (void)queueFlags;
+}
+
+int neo_aa_uring_submit(NeoAAUring ring, unsigned waitCount) {
+    (void)ring;
+    (void)waitCount;
+    return -1;
+}
+
+int neo_aa_uring_next_completion(NeoAAUring ring, uint64_t *userData, int32_t *result) {
+    (void)ring;
+    (void)userData;
+    (void)result;
+    return 0;
+}
+
+#endif
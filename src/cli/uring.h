@@ -0,0 +1,50 @@
+/*
+ *  uring.h
+ *  neoaa
+ */
+
+#ifndef neoaa_uring_h
+#define neoaa_uring_h
+
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct neo_aa_uring_impl *NeoAAUring;
+
+/* Links a queued operation to the one queued after it */
+#define NEOAA_URING_LINK 1
+/* Only posts a completion for the operation if it fails */
+#define NEOAA_URING_SKIP_SUCCESS 2
+
+/*
+ * NeoAAUring is a minimal io_uring submission and completion
+ * queue on the raw system calls, for batching the syscalls of
+ * creating many files. Files are opened into fileCount direct
+ * descriptors, addressed by index, so the operations on a file
+ * can be linked into one chain. Returns NULL where io_uring, or
+ * the direct descriptors and skipped completions it needs, are
+ * not available. queueFlags of queued operations are a mask of
+ * NEOAA_URING_LINK and NEOAA_URING_SKIP_SUCCESS.
+ */
+NeoAAUring neo_aa_uring_create(unsigned entries, unsigned fileCount);
+void neo_aa_uring_destroy(NeoAAUring ring);
+
+/* Free entries of the submission queue */
+unsigned neo_aa_uring_get_space(NeoAAUring ring);
+
+void neo_aa_uring_queue_openat(NeoAAUring ring, int dirFd, const char *name, int flags, mode_t mode, unsigned fileIndex, uint64_t userData, int queueFlags);
+void neo_aa_uring_queue_write(NeoAAUring ring, unsigned fileIndex, const void *data, uint32_t size, uint64_t offset, uint64_t userData, int queueFlags);
+void neo_aa_uring_queue_fdatasync(NeoAAUring ring, unsigned fileIndex, uint64_t userData, int queueFlags);
+void neo_aa_uring_queue_fadvise(NeoAAUring ring, unsigned fileIndex, uint64_t offset, uint32_t length, int advice, uint64_t userData, int queueFlags);
+void neo_aa_uring_queue_close(NeoAAUring ring, unsigned fileIndex, uint64_t userData, int queueFlags);
+
+/*
+ * Submits every queued operation and waits until at least
+ * waitCount of them completed. Returns -1 on error.
+ */
+int neo_aa_uring_submit(NeoAAUring ring, unsigned waitCount);
+
+/* Takes the next completion, returns 0 if there is none */
+int neo_aa_uring_next_completion(NeoAAUring ring, uint64_t *userData, int32_t *result);
+
+#endif /* neoaa_uring_h */